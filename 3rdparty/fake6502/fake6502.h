@@ -164,6 +164,18 @@ typedef unsigned int uint32;
 * support BCD operation.
 */
 
+/*
+* #define FAKE6502_LAZY_FLAGS
+* when this is defined, N, Z, C and V are not computed
+* by every instruction. The handlers only store the
+* value each flag is derived from, and the flags are
+* materialised when something reads them: branches,
+* ADC/SBC/ROL/ROR carry-in, PHP, BRK and interrupts.
+* Code outside the core must then go through
+* getstatus6502() and setstatus6502() instead of
+* using `status` directly.
+*/
+
 
 #define FLAG_CARRY     0x01
 #define FLAG_ZERO      0x02
@@ -181,21 +193,54 @@ typedef unsigned int uint32;
 
 
 /*flag modifier macros*/
-#define setcarry() status |= FLAG_CARRY
-#define clearcarry() status &= (~FLAG_CARRY)
-#define setzero() status |= FLAG_ZERO
-#define clearzero() status &= (~FLAG_ZERO)
 #define setinterrupt() status |= FLAG_INTERRUPT
 #define clearinterrupt() status &= (~FLAG_INTERRUPT)
 #define setdecimal() status |= FLAG_DECIMAL
 #define cleardecimal() status &= (~FLAG_DECIMAL)
+
+#ifndef FAKE6502_LAZY_FLAGS
+#define setcarry() status |= FLAG_CARRY
+#define clearcarry() status &= (~FLAG_CARRY)
+#define setzero() status |= FLAG_ZERO
+#define clearzero() status &= (~FLAG_ZERO)
 #define setoverflow() status |= FLAG_OVERFLOW
 #define clearoverflow() status &= (~FLAG_OVERFLOW)
 #define setsign() status |= FLAG_SIGN
 #define clearsign() status &= (~FLAG_SIGN)
 
+/*flag test macros, non-zero when the flag is set (carry is 0 or 1)*/
+#define carryflag() (status & FLAG_CARRY)
+#define zeroflag() (status & FLAG_ZERO)
+#define overflowflag() (status & FLAG_OVERFLOW)
+#define signflag() (status & FLAG_SIGN)
+#else
+/*lazy flags: Z is set when flag_zsrc is 0, C is set when flag_csrc has
+  bits above the low byte, N and V are bit 7 of flag_nsrc and flag_vsrc*/
+#define setcarry() flag_csrc = 0x100
+#define clearcarry() flag_csrc = 0
+#define setzero() flag_zsrc = 0
+#define clearzero() flag_zsrc = 1
+#define setoverflow() flag_vsrc = 0x80
+#define clearoverflow() flag_vsrc = 0
+#define setsign() flag_nsrc = 0x80
+#define clearsign() flag_nsrc = 0
+
+#define carryflag() ((flag_csrc & 0xFF00) != 0)
+#define zeroflag() (flag_zsrc == 0)
+#define overflowflag() (flag_vsrc & 0x80)
+#define signflag() (flag_nsrc & 0x80)
+#endif
+
 
 /*flag calculation macros*/
+#ifdef FAKE6502_LAZY_FLAGS
+#define zerocalc(n) { flag_zsrc = (uint8)(n); }
+#define signcalc(n) { flag_nsrc = (uint8)(n); }
+#define carrycalc(n) { flag_csrc = (ushort)(n); }
+#define overflowcalc(n, m, o) { /* n = result, m = accumulator, o = memory */ \
+    flag_vsrc = (uint8)(((n) ^ (ushort)(m)) & ((n) ^ (o)));\
+}
+#else
 #define zerocalc(n) {\
     if ((n) & 0x00FF) clearzero();\
         else setzero();\
@@ -215,6 +260,7 @@ typedef unsigned int uint32;
     if (((n) ^ (ushort)(m)) & ((n) ^ (o)) & 0x0080) setoverflow();\
         else clearoverflow();\
 }
+#endif
 
 
 #ifdef FAKE6502_NOT_STATIC
@@ -227,6 +273,10 @@ uint32 clockticks6502 = 0;
 uint32 clockgoal6502 = 0;
 ushort oldpc, ea, reladdr, value, result;
 uint8 opcode, oldstatus;
+#ifdef FAKE6502_LAZY_FLAGS
+uint8 flag_zsrc = 1, flag_nsrc = 0, flag_vsrc = 0;
+ushort flag_csrc = 0;
+#endif
 void reset6502();
 void nmi6502();
 void irq6502();
@@ -234,6 +284,8 @@ void irq6502();
 uint32 exec6502(uint32 tickcount);
 uint32 step6502();
 void hookexternal(void *funcptr);
+uint8 getstatus6502();
+void setstatus6502(uint8 newstatus);
 #else
 static ushort pc;
 static uint8 sp, a, x, y, status;
@@ -242,6 +294,10 @@ static uint32 clockticks6502 = 0;
 static uint32 clockgoal6502 = 0; 
 static ushort oldpc, ea, reladdr, value, result;
 static uint8 opcode, oldstatus;
+#ifdef FAKE6502_LAZY_FLAGS
+static uint8 flag_zsrc = 1, flag_nsrc = 0, flag_vsrc = 0;
+static ushort flag_csrc = 0;
+#endif
 #endif
 /*externally supplied functions*/
 extern uint8 read6502(ushort address);
@@ -271,6 +327,27 @@ static uint8 pull_6502_8() {
     return (read6502(BASE_STACK + ++sp));
 }
 
+/*the processor status as the program would see it*/
+uint8 getstatus6502() {
+#ifdef FAKE6502_LAZY_FLAGS
+    return (status & ~(FLAG_CARRY | FLAG_ZERO | FLAG_OVERFLOW | FLAG_SIGN)) |
+           (carryflag() ? FLAG_CARRY : 0) | (zeroflag() ? FLAG_ZERO : 0) |
+           (overflowflag() ? FLAG_OVERFLOW : 0) | (signflag() ? FLAG_SIGN : 0);
+#else
+    return status;
+#endif
+}
+
+void setstatus6502(uint8 newstatus) {
+    status = newstatus;
+#ifdef FAKE6502_LAZY_FLAGS
+    flag_csrc = (ushort)(newstatus & FLAG_CARRY) << 8;
+    flag_zsrc = (newstatus & FLAG_ZERO) ? 0 : 1;
+    flag_vsrc = (uint8)((newstatus & FLAG_OVERFLOW) << 1);
+    flag_nsrc = newstatus & FLAG_SIGN;
+#endif
+}
+
 static ushort mem_6502_read16(ushort addr) {
     return ((ushort)read6502(addr) |
             ((ushort)read6502(addr + 1) << 8));
@@ -412,9 +489,9 @@ static void adc() {
         ushort AL, A, result_dec;
         A = a;
         value = getvalue();
-        result_dec = (ushort)A + value + (ushort)(status & FLAG_CARRY); /*dec*/
+        result_dec = (ushort)A + value + (ushort)carryflag(); /*dec*/
         
-        AL = (A & 0x0F) + (value & 0x0F) + (ushort)(status & FLAG_CARRY);  /*SEQ 1A OR 2A*/
+        AL = (A & 0x0F) + (value & 0x0F) + (ushort)carryflag();  /*SEQ 1A OR 2A*/
         if(AL >= 0xA) AL = ((AL + 0x06) & 0x0F) + 0x10; /*SEQ 1B OR SEQ 2B*/
         A = (A & 0xF0) + (value & 0xF0) + AL; /*SEQ2C OR SEQ 1C*/
         if(A & 0x80) setsign(); else clearsign(); /*SEQ 2E it says "bit 7"*/
@@ -428,7 +505,7 @@ static void adc() {
 #endif
     {
         value = getvalue();
-        result = (ushort)a + value + (ushort)(status & FLAG_CARRY);
+        result = (ushort)a + value + (ushort)carryflag();
         carrycalc(result);
         zerocalc(result);
         overflowcalc(result, a, value);
@@ -460,7 +537,7 @@ static void asl() {
 }
 
 static void bcc() {
-    if ((status & FLAG_CARRY) == 0) {
+    if (!carryflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -469,7 +546,7 @@ static void bcc() {
 }
 
 static void bcs() {
-    if ((status & FLAG_CARRY) == FLAG_CARRY) {
+    if (carryflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -478,7 +555,7 @@ static void bcs() {
 }
 
 static void beq() {
-    if ((status & FLAG_ZERO) == FLAG_ZERO) {
+    if (zeroflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -491,11 +568,13 @@ static void bit() {
     result = (ushort)a & value;
    
     zerocalc(result);
-    status = (status & 0x3F) | (uint8)(value & 0xC0);
+    if (value & 0x40) setoverflow();
+        else clearoverflow();
+    signcalc(value);
 }
 
 static void bmi() {
-    if ((status & FLAG_SIGN) == FLAG_SIGN) {
+    if (signflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -504,7 +583,7 @@ static void bmi() {
 }
 
 static void bne() {
-    if ((status & FLAG_ZERO) == 0) {
+    if (!zeroflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -513,7 +592,7 @@ static void bne() {
 }
 
 static void bpl() {
-    if ((status & FLAG_SIGN) == 0) {
+    if (!signflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -524,13 +603,13 @@ static void bpl() {
 static void brk_6502() {
     pc++;
     push_6502_16(pc); 
-    push_6502_8(status | FLAG_BREAK); 
+    push_6502_8(getstatus6502() | FLAG_BREAK); 
     setinterrupt();
     pc = (ushort)read6502(0xFFFE) | ((ushort)read6502(0xFFFF) << 8);
 }
 
 static void bvc() {
-    if ((status & FLAG_OVERFLOW) == 0) {
+    if (!overflowflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -539,7 +618,7 @@ static void bvc() {
 }
 
 static void bvs() {
-    if ((status & FLAG_OVERFLOW) == FLAG_OVERFLOW) {
+    if (overflowflag()) {
         oldpc = pc;
         pc += reladdr;
         if ((oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; /*check if jump crossed a page boundary*/
@@ -733,7 +812,7 @@ static void pha() {
 }
 
 static void php() {
-    push_6502_8(status | FLAG_BREAK);
+    push_6502_8(getstatus6502() | FLAG_BREAK);
 }
 
 static void pla() {
@@ -744,12 +823,12 @@ static void pla() {
 }
 
 static void plp() {
-    status = pull_6502_8() | FLAG_CONSTANT;
+    setstatus6502(pull_6502_8() | FLAG_CONSTANT);
 }
 
 static void rol() {
     value = getvalue();
-    result = (value << 1) | (status & FLAG_CARRY);
+    result = (value << 1) | carryflag();
    
     carrycalc(result);
     zerocalc(result);
@@ -760,7 +839,7 @@ static void rol() {
 
 static void ror() {
     value = getvalue();
-    result = (value >> 1) | ((status & FLAG_CARRY) << 7);
+    result = (value >> 1) | (carryflag() << 7);
    
     if (value & 1) setcarry();
         else clearcarry();
@@ -771,7 +850,7 @@ static void ror() {
 }
 
 static void rti() {
-    status = pull_6502_8();
+    setstatus6502(pull_6502_8());
     value = pull_6502_16();
     pc = value;
 }
@@ -787,9 +866,9 @@ static void sbc() {
     if (status & FLAG_DECIMAL) {
     	ushort result_dec, A, AL, B, C;
     	A = a;
-    	C = (ushort)(status & FLAG_CARRY);
+    	C = (ushort)carryflag();
      	value = getvalue();B = value;value = value ^ 0x00FF;
-    	result_dec = (ushort)a + value + (ushort)(status & FLAG_CARRY); /*dec*/
+    	result_dec = (ushort)a + value + (ushort)carryflag(); /*dec*/
 		/*Both Cmos and Nmos*/
     	carrycalc(result_dec); 
     	overflowcalc(result_dec, a, value); 
@@ -806,7 +885,7 @@ static void sbc() {
 #endif
     {
         value = getvalue() ^ 0x00FF;
-        result = (ushort)a + value + (ushort)(status & FLAG_CARRY);
+        result = (ushort)a + value + (ushort)carryflag();
 	
         carrycalc(result);
         zerocalc(result);
@@ -1003,7 +1082,7 @@ static const uint32 ticktable[256] = {
 
 void nmi6502() {
     push_6502_16(pc);
-    push_6502_8(status  & ~FLAG_BREAK);
+    push_6502_8(getstatus6502() & ~FLAG_BREAK);
     status |= FLAG_INTERRUPT;
     pc = (ushort)read6502(0xFFFA) | ((ushort)read6502(0xFFFB) << 8);
 }
@@ -1017,7 +1096,7 @@ void irq6502() {
     */
 	if ((status & FLAG_INTERRUPT) == 0) {
 		push_6502_16(pc);
-		push_6502_8(status & ~FLAG_BREAK);
+		push_6502_8(getstatus6502() & ~FLAG_BREAK);
 		status |= FLAG_INTERRUPT;
 		/*pc = mem_6502_read16(0xfffe);*/
 		pc = (ushort)read6502(0xFFFE) | ((ushort)read6502(0xFFFF) << 8);
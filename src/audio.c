@@ -0,0 +1,535 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "audio.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIO_X86
+#include <immintrin.h>
+#endif
+
+#define AUDIOBLOCK 8192               /* output samples per file write */
+#define INPUTBLOCK 65536              /* chip samples rendered per resampler pass */
+#define TAPALIGN 16                   /* filter rows are padded to this many taps */
+
+enum { ATTACK, DECAY, RELEASE };
+
+typedef struct {
+    uint32_t acc;                     /* 24-bit phase */
+    uint32_t noise;                   /* 23-bit LFSR */
+    uint32_t noiseOut;                /* its 12-bit waveform */
+    uint16_t freq;
+    uint16_t pw;                      /* 12-bit */
+    uint8_t control;
+    uint8_t ad;
+    uint8_t sr;
+    uint8_t env;
+    uint8_t state;
+    uint8_t expCounter;
+    uint16_t rateCounter;
+    uint16_t period;                  /* of the current state's rate */
+} voice_t;
+
+/* Chip cycles per envelope step for each ADSR rate */
+static const uint16_t rate_periods[16] = {
+    9, 32, 63, 95, 149, 220, 267, 313, 392, 977, 1954, 3126, 3907, 11720, 19532, 31251
+};
+
+static uint8_t exp_periods[256];
+
+bool audio_enabled = false;
+
+static FILE* audio_file = NULL;
+static bool audio_floats = false;
+
+static voice_t voices[3];
+static uint8_t volume = 0;
+static uint8_t mode = 0;              /* $d418 high nibble */
+
+static uint64_t chip_time = 0;        /* chip samples rendered */
+static uint64_t frame_start = 0;      /* event cycle the current frame started at */
+static uint64_t frames = 0;
+
+/* Resampler, input indices are shifted by half - 1 zeros before the first sample */
+static struct {
+    uint32_t inRate;
+    uint32_t outRate;
+    int half;                         /* filter taps each side */
+    int taps;                         /* per row, padded */
+    int phases;
+    float* rows;                      /* phases + 1 rows of taps */
+
+    float* input;
+    size_t inputSize;
+    uint64_t inputStart;              /* shifted index of input[0] */
+    size_t inputUsed;
+
+    uint64_t outCount;
+    uint64_t outTotal;                /* output samples written to the file */
+    int16_t samples16[AUDIOBLOCK];
+    float samples32[AUDIOBLOCK];
+    int pending;
+} rs;
+
+typedef float (*dotfunc_t)(const float* coeffs, const float* samples, int n);
+
+static dotfunc_t dot_func = NULL;
+static const char* dot_name = NULL;
+
+static float dotScalar(const float* coeffs, const float* samples, int n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (int i = 0; i < n; i += 4) {
+        s0 += coeffs[i] * samples[i];
+        s1 += coeffs[i + 1] * samples[i + 1];
+        s2 += coeffs[i + 2] * samples[i + 2];
+        s3 += coeffs[i + 3] * samples[i + 3];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef AUDIO_X86
+__attribute__((target("sse2")))
+static float dotSSE2(const float* coeffs, const float* samples, int n) {
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+
+    for (int i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(coeffs + i), _mm_loadu_ps(samples + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(coeffs + i + 4), _mm_loadu_ps(samples + i + 4)));
+    }
+
+    float sum[4];
+    _mm_storeu_ps(sum, _mm_add_ps(s0, s1));
+
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+__attribute__((target("avx2,fma")))
+static float dotAVX2(const float* coeffs, const float* samples, int n) {
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+
+    for (int i = 0; i < n; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(coeffs + i), _mm256_loadu_ps(samples + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(coeffs + i + 8), _mm256_loadu_ps(samples + i + 8), s1);
+    }
+
+    __m256 s = _mm256_add_ps(s0, s1);
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+
+    float sum[4];
+    _mm_storeu_ps(sum, h);
+
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+#endif
+
+static void selectImplementation() {
+    dot_func = dotScalar;
+    dot_name = "scalar";
+
+#ifdef AUDIO_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        dot_func = dotAVX2;
+        dot_name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        dot_func = dotSSE2;
+        dot_name = "SSE2";
+    }
+#endif
+}
+
+const char* audioImplementation() {
+    if (dot_func == NULL) { selectImplementation(); }
+
+    return dot_name;
+}
+
+static double besselI0(double x) {
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/* Kaiser windowed sinc rows, row p is the filter shifted by p / phases of an input sample */
+static void designFilter(int quality) {
+    static const int crossings[] = { 8, 16, 32 };
+    static const int phases[] = { 128, 256, 512 };
+    static const double cutoffs[] = { 0.80, 0.88, 0.92 };
+    static const double betas[] = { 6.0, 8.0, 10.0 };
+
+    double ratio = (double)rs.inRate / rs.outRate;
+    double fc = 0.5 * cutoffs[quality] / (ratio > 1 ? ratio : 1);
+
+    rs.half = (int)ceil(crossings[quality] * (ratio > 1 ? ratio : 1));
+    rs.taps = (2 * rs.half + TAPALIGN - 1) / TAPALIGN * TAPALIGN;
+    rs.phases = phases[quality];
+    rs.rows = calloc((size_t)(rs.phases + 1) * rs.taps, sizeof(float));
+
+    double norm = besselI0(betas[quality]);
+
+    for (int p = 0; p <= rs.phases; p++) {
+        float* row = rs.rows + (size_t)p * rs.taps;
+        double sum = 0;
+
+        for (int t = 0; t < 2 * rs.half; t++) {
+            double d = (double)p / rs.phases + rs.half - 1 - t;
+            double r = d / rs.half;
+
+            if (r <= -1 || r >= 1) { continue; }
+
+            double x = 2 * fc * d;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+
+            row[t] = (float)(2 * fc * sinc * besselI0(betas[quality] * sqrt(1 - r * r)) / norm);
+            sum += row[t];
+        }
+
+        /* Unity gain at DC for every phase */
+        for (int t = 0; t < 2 * rs.half; t++) { row[t] = (float)(row[t] / sum); }
+    }
+}
+
+static void writeHeader(uint32_t samples) {
+    uint32_t bytes = samples * (audio_floats ? 4 : 2);
+    uint16_t format = audio_floats ? 3 : 1;
+    uint16_t bits = audio_floats ? 32 : 16;
+    uint16_t channels = 1;
+    uint16_t align = bits / 8;
+    uint32_t byteRate = rs.outRate * align;
+    uint32_t fmtSize = 16;
+    uint32_t riffSize = 36 + bytes;
+
+    fseek(audio_file, 0, SEEK_SET);
+
+    fwrite("RIFF", 1, 4, audio_file);
+    fwrite(&riffSize, 4, 1, audio_file);
+    fwrite("WAVEfmt ", 1, 8, audio_file);
+    fwrite(&fmtSize, 4, 1, audio_file);
+    fwrite(&format, 2, 1, audio_file);
+    fwrite(&channels, 2, 1, audio_file);
+    fwrite(&rs.outRate, 4, 1, audio_file);
+    fwrite(&byteRate, 4, 1, audio_file);
+    fwrite(&align, 2, 1, audio_file);
+    fwrite(&bits, 2, 1, audio_file);
+    fwrite("data", 1, 4, audio_file);
+    fwrite(&bytes, 4, 1, audio_file);
+}
+
+static void flushSamples() {
+    if (rs.pending == 0) { return; }
+
+    if (audio_floats) {
+        fwrite(rs.samples32, sizeof(float), rs.pending, audio_file);
+    } else {
+        fwrite(rs.samples16, sizeof(int16_t), rs.pending, audio_file);
+    }
+
+    rs.outTotal += rs.pending;
+    rs.pending = 0;
+}
+
+static void emit(float sample) {
+    if (audio_floats) {
+        rs.samples32[rs.pending] = sample;
+    } else {
+        float s = sample * 32767.0f;
+        rs.samples16[rs.pending] = (int16_t)(s > 32767.0f ? 32767 : (s < -32768.0f ? -32768 : lrintf(s)));
+    }
+
+    if (++rs.pending == AUDIOBLOCK) { flushSamples(); }
+}
+
+/* Produces every output sample whose window is in the input, up to limit */
+static void resample(uint64_t limit) {
+    uint64_t available = rs.inputStart + rs.inputUsed;
+
+    while (rs.outCount < limit) {
+        uint64_t position = rs.outCount * rs.inRate;
+        uint64_t q = position / rs.outRate;
+        uint64_t p = ((position % rs.outRate) * rs.phases + rs.outRate / 2) / rs.outRate;
+
+        if (q + rs.taps > available) { break; }
+
+        const float* row = rs.rows + p * rs.taps;
+        emit(dot_func(row, rs.input + (q - rs.inputStart), rs.taps));
+
+        rs.outCount++;
+    }
+
+    /* Keep the input from the next output's window on */
+    uint64_t next = rs.outCount * rs.inRate / rs.outRate;
+
+    if (next > rs.inputStart) {
+        size_t drop = (size_t)(next - rs.inputStart);
+        if (drop > rs.inputUsed) { drop = rs.inputUsed; }
+
+        memmove(rs.input, rs.input + drop, (rs.inputUsed - drop) * sizeof(float));
+        rs.inputUsed -= drop;
+        rs.inputStart += drop;
+    }
+}
+
+static inline uint32_t noiseOutput(uint32_t n) {
+    return ((n >> 9) & 0x800) | ((n >> 8) & 0x400) | ((n >> 5) & 0x200) | ((n >> 3) & 0x100) |
+           ((n >> 2) & 0x080) | ((n << 1) & 0x040) | ((n << 3) & 0x020) | ((n << 4) & 0x010);
+}
+
+/* 12-bit waveform, selected waveforms are ANDed together */
+static inline uint32_t waveform(const voice_t* v, uint32_t ringAcc) {
+    uint8_t c = v->control;
+    uint32_t out = 0xfff;
+
+    if ((c & 0xf0) == 0) { return 0x800; }
+
+    if (c & 0x10) {
+        uint32_t msb = (c & 0x04 ? v->acc ^ ringAcc : v->acc) & 0x800000;
+        out &= ((msb ? ~v->acc : v->acc) >> 11) & 0xfff;
+    }
+
+    if (c & 0x20) { out &= v->acc >> 12; }
+    if (c & 0x40) { out &= (c & 0x08) || (v->acc >> 12) >= v->pw ? 0xfff : 0; }
+    if (c & 0x80) { out &= v->noiseOut; }
+
+    return out;
+}
+
+static void setState(voice_t* v, uint8_t state) {
+    int rate = state == ATTACK ? v->ad >> 4 : (state == DECAY ? v->ad & 15 : v->sr & 15);
+
+    v->state = state;
+    v->period = rate_periods[rate];
+}
+
+static inline void envelopeClock(voice_t* v) {
+    if (++v->rateCounter < v->period) { return; }
+    v->rateCounter = 0;
+
+    if (v->state == ATTACK) {
+        if (++v->env == 0xff) { setState(v, DECAY); }
+        return;
+    }
+
+    if (++v->expCounter < exp_periods[v->env]) { return; }
+    v->expCounter = 0;
+
+    uint8_t floor = v->state == DECAY ? (v->sr >> 4) * 0x11 : 0;
+    if (v->env > floor) { v->env--; }
+}
+
+/* Steps the phase and the noise it clocks, true when the MSB went up, which syncs */
+static inline bool oscillatorClock(voice_t* v) {
+    uint32_t prev = v->acc;
+
+    if (v->control & 0x08) { return false; }
+
+    v->acc = (v->acc + v->freq) & 0xffffff;
+
+    if (~prev & v->acc & 0x080000) {
+        v->noise = ((v->noise << 1) | (((v->noise >> 22) ^ (v->noise >> 17)) & 1)) & 0x7fffff;
+        v->noiseOut = noiseOutput(v->noise);
+    }
+
+    return (~prev & v->acc & 0x800000) != 0;
+}
+
+/* Source is the voice that syncs and ring modulates v */
+static inline int32_t voiceOutput(voice_t* v, const voice_t* source, bool sourceRose, bool muted) {
+    if ((v->control & 0x02) && sourceRose) { v->acc = 0; }
+
+    envelopeClock(v);
+
+    if (v->env == 0 || muted) { return 0; }
+
+    return ((int32_t)waveform(v, source->acc) - 0x800) * v->env;
+}
+
+/* Renders chip samples into the resampler input until chip_time reaches until */
+static void render(uint64_t until) {
+    /* Three voices at full level make 3/4 of full scale, the rest is headroom for ringing */
+    float scale = volume / (15.0f * 4 * 2048 * 255);
+    bool muted = (mode & 0x80) != 0;
+
+    while (chip_time < until) {
+        if (rs.inputUsed == rs.inputSize) { resample(UINT64_MAX); }
+
+        size_t n = rs.inputSize - rs.inputUsed;
+        if (n > until - chip_time) { n = (size_t)(until - chip_time); }
+
+        float* out = rs.input + rs.inputUsed;
+
+        /* The voices written out, a loop over them costs a third more */
+        for (size_t i = 0; i < n; i++) {
+            bool rose0 = oscillatorClock(&voices[0]);
+            bool rose1 = oscillatorClock(&voices[1]);
+            bool rose2 = oscillatorClock(&voices[2]);
+
+            int32_t mix = voiceOutput(&voices[0], &voices[2], rose2, false);
+            mix += voiceOutput(&voices[1], &voices[0], rose0, false);
+            mix += voiceOutput(&voices[2], &voices[1], rose1, muted);
+
+            out[i] = mix * scale;
+        }
+
+        rs.inputUsed += n;
+        chip_time += n;
+    }
+}
+
+static void sidWrite(uint8_t reg, uint8_t value) {
+    if (reg >= 0x15) {
+        if (reg == 0x18) {
+            volume = value & 15;
+            mode = value & 0xf0;
+        }
+
+        return;
+    }
+
+    voice_t* v = &voices[reg / 7];
+
+    switch (reg % 7) {
+        case 0: v->freq = (v->freq & 0xff00) | value; break;
+        case 1: v->freq = (v->freq & 0x00ff) | (value << 8); break;
+        case 2: v->pw = (v->pw & 0xf00) | value; break;
+        case 3: v->pw = (v->pw & 0x0ff) | ((value & 15) << 8); break;
+        case 5: v->ad = value; setState(v, v->state); break;
+        case 6: v->sr = value; setState(v, v->state); break;
+
+        case 4:
+            if ((value & 0x01) && !(v->control & 0x01)) {
+                setState(v, ATTACK);
+            } else if (!(value & 0x01) && (v->control & 0x01)) {
+                setState(v, RELEASE);
+            }
+
+            if (value & 0x08) {
+                v->acc = 0;
+                v->noise = 0x7ffff8;
+                v->noiseOut = noiseOutput(v->noise);
+            }
+
+            v->control = value;
+            break;
+    }
+}
+
+/* Event cycles only count the play routine, audio time counts whole rasters */
+static uint64_t chipTime(uint64_t cycle) {
+    uint64_t offset = cycle > frame_start ? cycle - frame_start : 0;
+    if (offset >= RASTERCYCLES) { offset = RASTERCYCLES - 1; }
+
+    return frames * RASTERCYCLES + offset;
+}
+
+void audioWrite(uint64_t cycle, uint8_t reg, uint8_t value) {
+    render(chipTime(cycle));
+    sidWrite(reg, value);
+}
+
+void audioFrame(uint64_t cycle) {
+    frames++;
+    frame_start = cycle;
+
+    render(frames * RASTERCYCLES);
+    resample(UINT64_MAX);
+}
+
+void audioOpen(const char* filename, bool overwrite, uint32_t rate, int quality, bool floats) {
+    if (!overwrite && access(filename, F_OK) == 0) {
+        printf("Audio file `%s` already exists. Exiting...\n", filename);
+        exit(1);
+    }
+
+    if (rate < 8000 || rate > CHIPCLOCK) {
+        printf("Audio rate %u out of range. Exiting...\n", rate);
+        exit(1);
+    }
+
+    audio_file = createFile(filename, "wb");
+
+    if (audio_file == NULL) {
+        printf("Couldn't create audio file `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(audio_file, buffer, _IOFBF, sizeof(buffer));
+
+    if (dot_func == NULL) { selectImplementation(); }
+
+    if (quality < 0) { quality = 0; }
+    if (quality > 2) { quality = 2; }
+
+    memset(&rs, 0, sizeof(rs));
+    rs.inRate = CHIPCLOCK;
+    rs.outRate = rate;
+    designFilter(quality);
+
+    rs.inputSize = rs.taps + INPUTBLOCK;
+    rs.input = calloc(rs.inputSize, sizeof(float));
+    rs.inputUsed = rs.half - 1;
+
+    for (int i = 0; i < 256; i++) {
+        exp_periods[i] = i >= 0x5d ? 1 : (i >= 0x36 ? 2 : (i >= 0x1a ? 4 : (i >= 0x0e ? 8 : (i >= 0x06 ? 16 : 30))));
+    }
+
+    memset(voices, 0, sizeof(voices));
+    for (int k = 0; k < 3; k++) {
+        voices[k].noise = 0x7ffff8;
+        voices[k].noiseOut = noiseOutput(voices[k].noise);
+        setState(&voices[k], RELEASE);
+    }
+
+    volume = mode = 0;
+    chip_time = frame_start = frames = 0;
+    audio_floats = floats;
+    writeHeader(0);
+
+    verbose("Audio: %u Hz, %d taps x %d phases, %s\n", rate, rs.taps, rs.phases, dot_name);
+
+    audio_enabled = true;
+}
+
+void audioClose() {
+    if (!audio_enabled) { return; }
+
+    /* Zeros after the end complete the last windows */
+    uint64_t total = chip_time * rs.outRate / rs.inRate;
+
+    for (int i = 0; i < 2 && rs.outCount < total; i++) {
+        size_t n = rs.inputSize - rs.inputUsed;
+        memset(rs.input + rs.inputUsed, 0, n * sizeof(float));
+        rs.inputUsed += n;
+
+        resample(total);
+    }
+
+    flushSamples();
+    writeHeader((uint32_t)rs.outTotal);
+
+    fclose(audio_file);
+    audio_file = NULL;
+
+    free(rs.rows);
+    free(rs.input);
+    rs.rows = rs.input = NULL;
+
+    verbose("Audio: %.1f seconds\n", (double)rs.outTotal / rs.outRate);
+
+    audio_enabled = false;
+}
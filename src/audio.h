@@ -0,0 +1,32 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "sidulator.h"
+
+#define CHIPCLOCK 985248              /* PAL SID clock, one sample per cycle */
+#define AUDIORATE 44100
+#define AUDIOQUALITY 1
+
+/*
+ * Audio previews rendered from the SID writes of the event ring, on its
+ * consumer thread. Writes are placed in real time: each frame is a PAL
+ * raster of RASTERCYCLES, whatever the play routine took. Three voices
+ * with their oscillators, noise, sync, ring modulation and envelopes are
+ * rendered at the chip clock, without the filter, and decimated to the
+ * output rate by a windowed sinc polyphase resampler. Its dot products run
+ * 8 or 4 floats at a time with AVX2 or SSE2 when the CPU has them.
+ *
+ * Quality 0 to 2 sets the filter length to 8, 16 or 32 output samples
+ * each side, which is also the output's look-ahead latency, and the phase
+ * resolution to 128, 256 or 512 steps per input sample. The output is a
+ * mono 16-bit or float WAV written in blocks.
+ */
+extern bool audio_enabled;
+
+void audioOpen(const char* filename, bool overwrite, uint32_t rate, int quality, bool floats);
+void audioWrite(uint64_t cycle, uint8_t reg, uint8_t value);
+void audioFrame(uint64_t cycle);                        /* the frame that ended at cycle */
+void audioClose();
+const char* audioImplementation();
+
+#endif
@@ -0,0 +1,867 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "corpus.h"
+#include "psid.h"
+#include "hash.h"
+#include "store.h"
+#include "telemetry.h"
+
+#define TARBLOCK 512
+#define MAXPATH 4096
+
+/* Supervisor wakeup in ms when no results come, for telemetry and the budget checks */
+#define CORPUSPOLL 100
+/* A worker whose cycle meter doesn't move for this many ms is killed */
+#define CORPUSSTALL 10000
+
+/* Spins before sleeping when a result ring is full */
+#define RINGSPIN 256
+#define RINGSLEEP 50000               /* ns */
+
+/* Result ring bytes per worker, the largest diff is under 200 KB */
+#define RESULTRING (4 << 20)
+
+/* Result status codes beyond the PSID_* ones */
+#define CORPUS_TIMEOUT 100
+#define CORPUS_IOERROR 101
+#define CORPUS_CRASHED 102
+#define CORPUS_BUDGET 103
+#define CORPUS_STALLED 104
+
+typedef struct {
+    char* name;                 /* relative to the corpus root, or the archive member name */
+    const uint8_t* data;        /* inside the archive mapping, NULL for directory trees */
+    size_t size;
+} corpusentry_t;
+
+/* Result record, in a ring after its 8-byte length and followed by diffSize bytes */
+typedef struct {
+    uint32_t entry;
+    uint16_t subtune;
+    uint16_t status;
+    uint32_t frames;
+    uint32_t maxFrameCycles;
+    uint64_t fingerprint;
+    uint64_t tuneKey;
+    uint64_t diffKey;
+    uint32_t diffSize;
+} corpusresult_t;
+
+/* Shared between a worker and the supervisor. Head and tail on their own
+   cache lines, the entry being run and its cycles so far on the worker's. */
+typedef struct {
+    uint64_t head __attribute__((aligned(64)));         /* written by the worker */
+    int32_t entry;                                      /* -1 between entries */
+    uint16_t subtune;
+    uint16_t songs;                                     /* of the entry, 0 until parsed */
+    uint64_t cycles;
+
+    uint64_t tail __attribute__((aligned(64)));         /* written by the supervisor */
+
+    uint8_t data[RESULTRING] __attribute__((aligned(64)));
+} resultring_t;
+
+typedef struct {
+    sem_t ready;                /* posted for every record */
+    uint32_t next;              /* the job queue, next entry to take */
+} corpusshared_t;
+
+typedef struct {
+    pid_t pid;                  /* 0 once retired */
+    resultring_t* ring;
+    int killed;                 /* status for the entry the supervisor killed it on */
+    int32_t entry;              /* last seen, for the stall check */
+    uint64_t cycles;
+    double progress;            /* ms, when the meter last moved */
+} corpusworker_t;
+
+static corpusentry_t* entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+
+/* Entries left for the workers, the rest were found in the store */
+static uint32_t* pending = NULL;
+static int pending_count = 0;
+
+static corpusresult_t* results = NULL;
+static int result_count = 0;
+static int result_capacity = 0;
+
+static const char* corpus_root = NULL;
+
+static corpusshared_t* shared = NULL;
+static resultring_t* worker_ring = NULL;       /* in a worker, its own */
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void backoff(int* spins) {
+    if (++*spins < RINGSPIN) {
+        sched_yield();
+        return;
+    }
+
+    struct timespec ts = { 0, RINGSLEEP };
+    nanosleep(&ts, NULL);
+}
+
+static void* growArray(void* array, int* capacity, int count, size_t itemSize) {
+    if (count < *capacity) { return array; }
+
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    array = realloc(array, *capacity * itemSize);
+
+    if (array == NULL) {
+        printf("Out of memory. Exiting...\n");
+        exit(1);
+    }
+
+    return array;
+}
+
+static void addEntry(const char* name, const uint8_t* data, size_t size) {
+    entries = growArray(entries, &entry_capacity, entry_count, sizeof(entries[0]));
+
+    size_t len = strlen(name);
+    entries[entry_count].name = malloc(len + 1);
+    memcpy(entries[entry_count].name, name, len + 1);
+    entries[entry_count].data = data;
+    entries[entry_count].size = size;
+    entry_count++;
+}
+
+static bool isSid(const uint8_t* data, size_t size) {
+    return size >= 4 && (memcmp(data, "PSID", 4) == 0 || memcmp(data, "RSID", 4) == 0);
+}
+
+static const uint8_t* mapFile(const char* filename, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { return NULL; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) { return NULL; }
+
+    *size = st.st_size;
+    return data;
+}
+
+static void scanDirectory(const char* relative) {
+    char path[MAXPATH];
+    snprintf(path, sizeof(path), "%s%s%s", corpus_root, *relative ? "/" : "", relative);
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        printf("Couldn't open directory `%s`, skipping.\n", path);
+        return;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') { continue; }
+
+        char name[MAXPATH];
+        snprintf(name, sizeof(name), "%s%s%s", relative, *relative ? "/" : "", de->d_name);
+        snprintf(path, sizeof(path), "%s/%s", corpus_root, name);
+
+        struct stat st;
+        if (stat(path, &st) != 0) { continue; }
+
+        if (S_ISDIR(st.st_mode)) {
+            scanDirectory(name);
+            continue;
+        }
+
+        size_t len = strlen(name);
+        if (S_ISREG(st.st_mode) && len > 4 && strcasecmp(name + len - 4, ".sid") == 0) {
+            addEntry(name, NULL, st.st_size);
+        }
+    }
+
+    closedir(dir);
+}
+
+static size_t tarNumber(const uint8_t* field, size_t len) {
+    size_t value = 0;
+
+    for (size_t i = 0; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+
+    return value;
+}
+
+static void scanArchive(const uint8_t* archive, size_t size) {
+    char longname[MAXPATH] = "";
+    size_t offset = 0;
+
+    while (offset + TARBLOCK <= size) {
+        const uint8_t* header = archive + offset;
+
+        if (header[0] == '\0') { break; }
+
+        size_t filesize = tarNumber(header + 124, 12);
+        const uint8_t* data = header + TARBLOCK;
+        char type = (char)header[156];
+
+        if (data + filesize > archive + size) { break; }
+
+        if (type == 'L') {
+            size_t len = filesize < sizeof(longname) - 1 ? filesize : sizeof(longname) - 1;
+            memcpy(longname, data, len);
+            longname[len] = '\0';
+        } else {
+            if ((type == '0' || type == '\0') && isSid(data, filesize)) {
+                char name[MAXPATH];
+
+                if (longname[0] != '\0') {
+                    snprintf(name, sizeof(name), "%s", longname);
+                } else if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                    snprintf(name, sizeof(name), "%.155s/%.100s", (const char*)header + 345, (const char*)header);
+                } else {
+                    snprintf(name, sizeof(name), "%.100s", (const char*)header);
+                }
+
+                addEntry(name, data, filesize);
+            }
+
+            longname[0] = '\0';
+        }
+
+        offset += TARBLOCK + (filesize + TARBLOCK - 1) / TARBLOCK * TARBLOCK;
+    }
+}
+
+static void tarHeader(FILE* fp, const char* name, size_t size, char type) {
+    uint8_t header[TARBLOCK];
+    memset(header, 0, sizeof(header));
+
+    size_t len = strlen(name);
+    const char* slash = len > 100 ? strchr(name + len - 101, '/') : NULL;
+
+    if (len <= 100) {
+        memcpy(header, name, len);
+    } else if (slash != NULL && slash - name <= 155) {
+        memcpy(header + 345, name, slash - name);
+        memcpy(header, slash + 1, len - (slash - name) - 1);
+    } else {
+        tarHeader(fp, "././@LongLink", len + 1, 'L');
+        fwrite(name, 1, len + 1, fp);
+
+        uint8_t padding[TARBLOCK] = { 0 };
+        fwrite(padding, 1, (TARBLOCK - (len + 1) % TARBLOCK) % TARBLOCK, fp);
+
+        memcpy(header, name, 100);
+    }
+
+    snprintf((char*)header + 100, 8, "%07o", 0644);
+    snprintf((char*)header + 108, 8, "%07o", 0);
+    snprintf((char*)header + 116, 8, "%07o", 0);
+    snprintf((char*)header + 124, 12, "%011lo", (unsigned long)size);
+    snprintf((char*)header + 136, 12, "%011o", 0);
+    header[156] = (uint8_t)type;
+    memcpy(header + 257, "ustar\0" "00", 8);
+
+    memset(header + 148, ' ', 8);
+
+    unsigned int checksum = 0;
+    for (int i = 0; i < TARBLOCK; i++) { checksum += header[i]; }
+
+    snprintf((char*)header + 148, 8, "%06o", checksum);
+
+    fwrite(header, 1, sizeof(header), fp);
+}
+
+static void tarWrite(FILE* fp, const char* name, const void* data, size_t size) {
+    tarHeader(fp, name, size, '0');
+    fwrite(data, 1, size, fp);
+
+    uint8_t padding[TARBLOCK] = { 0 };
+    fwrite(padding, 1, (TARBLOCK - size % TARBLOCK) % TARBLOCK, fp);
+}
+
+/* Copies one record into the worker's ring, waiting while the supervisor makes room */
+static void sendResult(corpusresult_t* result, const void* diff) {
+    resultring_t* r = worker_ring;
+    uint64_t length = (sizeof(uint64_t) + sizeof(*result) + result->diffSize + 7) & ~(uint64_t)7;
+    uint64_t head = r->head;
+    uint64_t at = head % RESULTRING;
+    uint64_t skip = at + length > RESULTRING ? RESULTRING - at : 0;
+
+    int spins = 0;
+    while (head + skip + length - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > RESULTRING) { backoff(&spins); }
+
+    /* A zero length sends the reader back to the start */
+    if (skip > 0) {
+        memset(r->data + at, 0, sizeof(uint64_t));
+        head += skip;
+        at = 0;
+    }
+
+    uint8_t* record = r->data + at;
+    memcpy(record, &length, sizeof(length));
+    memcpy(record + sizeof(length), result, sizeof(*result));
+    if (result->diffSize > 0) { memcpy(record + sizeof(length) + sizeof(*result), diff, result->diffSize); }
+
+    __atomic_store_n(&r->head, head + length, __ATOMIC_RELEASE);
+    sem_post(&shared->ready);
+}
+
+/* Sends the result for the current memory and statistics at one fixed time */
+static void sendFrame(const corpusjob_t* job, uint32_t index, int subtune, int frame, bool timeout,
+                      uint64_t tuneKey, const driver_t* driver) {
+    corpusresult_t result;
+    memset(&result, 0, sizeof(result));
+    result.entry = index;
+    result.subtune = (uint16_t)subtune;
+    result.frames = (uint32_t)frame;
+    result.tuneKey = tuneKey;
+
+    if (timeout) {
+        result.status = CORPUS_TIMEOUT;
+        sendResult(&result, NULL);
+        return;
+    }
+
+    result.maxFrameCycles = play_stats.maxFrameCycles;
+    result.fingerprint = hash64(memory, MEMSIZE, HASH_INIT);
+
+    char* diff = NULL;
+    size_t diffSize = 0;
+
+    if (job->diffs) {
+        filterChanges(job->includeRegions);
+        ignoreRegion(driver->page << 8, (driver->page << 8) | 0xff);
+
+        FILE* mem = open_memstream(&diff, &diffSize);
+        writeDiff(mem, memory, memory_changes);
+        fclose(mem);
+
+        result.diffSize = (uint32_t)diffSize;
+    }
+
+    sendResult(&result, diff);
+    free(diff);
+}
+
+/* The tune with the driver installed, loaded once per tune. Subtunes
+   start from it with only the pages the previous one dirtied copied back. */
+static template_t tune_template;
+
+/* Plays one subtune, sending every fixed time */
+static void runSubtune(const corpusjob_t* job, uint32_t index, const driver_t* driver, int subtune, uint64_t tuneKey) {
+    worker_ring->subtune = (uint16_t)subtune;
+
+    templateReset(&tune_template);
+    psidSubtune(driver, subtune);
+
+    startMusic(driver->start);
+
+    for (int f = 0; f < job->frameCount; f++) {
+        bool timeout = playMusic(driver->frameCounter, driver->flipflop, job->frames[f]) < 0;
+
+        sendFrame(job, index, subtune, job->frames[f], timeout, tuneKey, driver);
+        if (timeout) { break; }
+    }
+}
+
+static void runTune(const corpusjob_t* job, uint32_t index, const uint8_t* data, size_t size) {
+    psid_t psid;
+    int status = psidParse(data, size, &psid);
+
+    if (status != PSID_OK) {
+        corpusresult_t result;
+        memset(&result, 0, sizeof(result));
+        result.entry = index;
+        result.status = (uint16_t)status;
+        sendResult(&result, NULL);
+        return;
+    }
+
+    worker_ring->songs = psid.songs;
+
+    uint64_t tuneKey = hash64(data, size, job->optionsKey);
+
+    /* The driver page only depends on the tune, so one install covers every subtune */
+    driver_t driver;
+    clearMemory(0);
+    status = psidInstall(&psid, 1, &driver);
+
+    if (status != PSID_OK) {
+        corpusresult_t result;
+        memset(&result, 0, sizeof(result));
+        result.entry = index;
+        result.status = (uint16_t)status;
+        sendResult(&result, NULL);
+        return;
+    }
+
+    templateCapture(&tune_template, driver.start);
+
+    for (int subtune = 1; subtune <= psid.songs; subtune++) {
+        runSubtune(job, index, &driver, subtune, tuneKey);
+    }
+}
+
+/* Takes entries off the shared counter until none are left, publishing
+   the one it's on and the cycles spent on it for the supervisor */
+static void runWorker(const corpusjob_t* job, resultring_t* ring) {
+    worker_ring = ring;
+    cycle_meter = &ring->cycles;
+
+    trackChanges(job->diffs);
+
+    /* Progress is reported by the parent */
+    telemetry_enabled = false;
+
+    uint32_t slot;
+    while ((slot = __sync_fetch_and_add(&shared->next, 1)) < (uint32_t)pending_count) {
+        uint32_t index = pending[slot];
+        const corpusentry_t* e = &entries[index];
+
+        __atomic_store_n(&ring->cycles, 0, __ATOMIC_RELAXED);
+        ring->subtune = 0;
+        ring->songs = 0;
+        __atomic_store_n(&ring->entry, (int32_t)index, __ATOMIC_RELEASE);
+
+        if (e->data != NULL) {
+            runTune(job, index, e->data, e->size);
+        } else {
+            char path[MAXPATH];
+            snprintf(path, sizeof(path), "%s/%s", corpus_root, e->name);
+
+            size_t size = 0;
+            const uint8_t* data = mapFile(path, &size);
+
+            if (data == NULL) {
+                corpusresult_t result;
+                memset(&result, 0, sizeof(result));
+                result.entry = index;
+                result.status = CORPUS_IOERROR;
+                sendResult(&result, NULL);
+            } else {
+                runTune(job, index, data, size);
+                munmap((void*)data, size);
+            }
+        }
+
+        __atomic_store_n(&ring->entry, -1, __ATOMIC_RELEASE);
+    }
+}
+
+static const char* statusName(int status) {
+    switch (status) {
+        case CORPUS_TIMEOUT: return "hung, stopped by the watchdog";
+        case CORPUS_IOERROR: return "couldn't read file";
+        case CORPUS_CRASHED: return "worker crashed";
+        case CORPUS_BUDGET: return "over the cycle budget, worker killed";
+        case CORPUS_STALLED: return "stalled, worker killed";
+    }
+
+    return psidError(status);
+}
+
+static void collectResult(FILE* tar, const corpusjob_t* job, corpusresult_t* result, const uint8_t* diff) {
+    if (job->diffs && result->status == PSID_OK) {
+        if (job->store != NULL) {
+            result->diffKey = storePutRun(result->tuneKey, result->subtune, (int)result->frames, diff, result->diffSize,
+                                          result->fingerprint, result->maxFrameCycles);
+        } else {
+            char name[MAXPATH];
+            snprintf(name, sizeof(name), "%s/%d/%u.diff", entries[result->entry].name, result->subtune, result->frames);
+            tarWrite(tar, name, diff, result->diffSize);
+
+            result->diffKey = hash64(diff, result->diffSize, HASH_INIT);
+        }
+    }
+
+    results = growArray(results, &result_capacity, result_count, sizeof(results[0]));
+    results[result_count++] = *result;
+}
+
+/* Collects the records published so far straight from the ring */
+static void drainRing(FILE* tar, const corpusjob_t* job, resultring_t* r) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+
+    while (tail != head) {
+        uint64_t at = tail % RESULTRING;
+        uint64_t length;
+        memcpy(&length, r->data + at, sizeof(length));
+
+        if (length == 0) {
+            tail += RESULTRING - at;
+            continue;
+        }
+
+        corpusresult_t result;
+        memcpy(&result, r->data + at + sizeof(length), sizeof(result));
+        collectResult(tar, job, &result, r->data + at + sizeof(length) + sizeof(result));
+
+        /* Per record, so a waiting worker gets its room back early */
+        tail += length;
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Takes the results of an entry straight from the store when every run of
+   every subtune is there, returns false if a worker has to play it */
+static bool storedTune(const corpusjob_t* job, uint32_t index) {
+    const corpusentry_t* e = &entries[index];
+    const uint8_t* data = e->data;
+    size_t size = e->size;
+
+    if (data == NULL) {
+        char path[MAXPATH];
+        snprintf(path, sizeof(path), "%s/%s", corpus_root, e->name);
+        data = mapFile(path, &size);
+
+        if (data == NULL) { return false; }
+    }
+
+    psid_t psid;
+    bool found = psidParse(data, size, &psid) == PSID_OK;
+    uint64_t tuneKey = hash64(data, size, job->optionsKey);
+
+    if (e->data == NULL) { munmap((void*)data, size); }
+    if (!found) { return false; }
+
+    int count = psid.songs * job->frameCount;
+    storerun_t* runs = malloc(count * sizeof(storerun_t));
+
+    for (int i = 0; i < count && found; i++) {
+        found = storeLookupRun(tuneKey, 1 + i / job->frameCount, job->frames[i % job->frameCount], &runs[i]);
+    }
+
+    for (int i = 0; i < count && found; i++) {
+        corpusresult_t result;
+        memset(&result, 0, sizeof(result));
+        result.entry = index;
+        result.subtune = (uint16_t)(1 + i / job->frameCount);
+        result.frames = (uint32_t)job->frames[i % job->frameCount];
+        result.maxFrameCycles = runs[i].maxFrameCycles;
+        result.fingerprint = runs[i].fingerprint;
+        result.tuneKey = tuneKey;
+        result.diffKey = runs[i].diffKey;
+        result.diffSize = runs[i].diffSize;
+
+        results = growArray(results, &result_capacity, result_count, sizeof(results[0]));
+        results[result_count++] = result;
+    }
+
+    free(runs);
+
+    return found;
+}
+
+static pid_t startWorker(const corpusjob_t* job, resultring_t* ring) {
+    ring->head = ring->tail = 0;
+    ring->entry = -1;
+    ring->cycles = 0;
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        printf("Couldn't start a worker. Exiting...\n");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        runWorker(job, ring);
+        _exit(0);
+    }
+
+    return pid;
+}
+
+/* Kills a worker over the cycle budget on its tune or whose meter stopped moving */
+static void checkWorker(const corpusjob_t* job, corpusworker_t* w, double time) {
+    int32_t entry = __atomic_load_n(&w->ring->entry, __ATOMIC_ACQUIRE);
+    uint64_t cycles = __atomic_load_n(&w->ring->cycles, __ATOMIC_RELAXED);
+
+    if (entry != w->entry || cycles != w->cycles) {
+        w->entry = entry;
+        w->cycles = cycles;
+        w->progress = time;
+    }
+
+    if (entry < 0 || w->killed != 0) { return; }
+
+    if (job->tuneCycles > 0 && cycles > job->tuneCycles) {
+        w->killed = CORPUS_BUDGET;
+    } else if (time - w->progress > CORPUSSTALL) {
+        w->killed = CORPUS_STALLED;
+    } else {
+        return;
+    }
+
+    kill(w->pid, SIGKILL);
+}
+
+/* Marks the subtune a dead worker was on and the ones after it that it
+   never got to, returns true if it died on an entry */
+static bool buryWorker(FILE* tar, const corpusjob_t* job, corpusworker_t* w, int index, int wstatus) {
+    drainRing(tar, job, w->ring);
+
+    int32_t entry = w->ring->entry;
+    bool clean = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+
+    if (entry < 0) {
+        if (!clean) { printf("Worker %d died between tunes\n", index); }
+        return !clean;
+    }
+
+    /* Before the first subtune started, the whole tune is lost */
+    int songs = w->ring->songs;
+    int first = w->ring->subtune > 0 ? w->ring->subtune : (songs > 0 ? 1 : 0);
+    int status = w->killed != 0 ? w->killed : CORPUS_CRASHED;
+
+    for (int subtune = first; subtune == first || subtune <= songs; subtune++) {
+        corpusresult_t result;
+        memset(&result, 0, sizeof(result));
+        result.entry = (uint32_t)entry;
+        result.subtune = (uint16_t)subtune;
+        result.status = (uint16_t)status;
+        collectResult(tar, job, &result, NULL);
+    }
+
+    printf("Worker %d on `%s` subtune %d: %s", index, entries[entry].name, first, statusName(status));
+    if (songs == first + 1) { printf(", subtune %d not run", songs); }
+    if (songs > first + 1) { printf(", subtunes %d-%d not run", first + 1, songs); }
+    putchar('\n');
+
+    return true;
+}
+
+static int compareResults(const void* a, const void* b) {
+    const corpusresult_t* ra = a;
+    const corpusresult_t* rb = b;
+
+    if (ra->entry != rb->entry) { return ra->entry < rb->entry ? -1 : 1; }
+    if (ra->subtune != rb->subtune) { return ra->subtune < rb->subtune ? -1 : 1; }
+    if (ra->frames != rb->frames) { return ra->frames < rb->frames ? -1 : 1; }
+
+    return 0;
+}
+
+static void writeIndex(FILE* tar) {
+    /* Entries that produced nothing were taken by a worker that died */
+    bool* seen = calloc(entry_count, sizeof(bool));
+    for (int i = 0; i < result_count; i++) { seen[results[i].entry] = true; }
+
+    for (int i = 0; i < entry_count; i++) {
+        if (seen[i]) { continue; }
+
+        corpusresult_t result;
+        memset(&result, 0, sizeof(result));
+        result.entry = (uint32_t)i;
+        result.status = CORPUS_CRASHED;
+
+        results = growArray(results, &result_capacity, result_count, sizeof(results[0]));
+        results[result_count++] = result;
+    }
+
+    free(seen);
+    qsort(results, result_count, sizeof(results[0]), compareResults);
+
+    char* index = NULL;
+    size_t indexSize = 0;
+    FILE* fp = open_memstream(&index, &indexSize);
+
+    fprintf(fp, "sid\tsubtune\tframes\tstatus\tfingerprint\tmaxframecycles\tdiffbytes\tdiffhash\n");
+
+    for (int i = 0; i < result_count; i++) {
+        const corpusresult_t* r = &results[i];
+
+        fprintf(fp, "%s\t%d\t%u\t%s\t%016llx\t%u\t%u\t%016llx\n", entries[r->entry].name, r->subtune, r->frames,
+                statusName(r->status), (unsigned long long)r->fingerprint, r->maxFrameCycles, r->diffSize,
+                (unsigned long long)r->diffKey);
+    }
+
+    fclose(fp);
+
+    tarWrite(tar, "index.tsv", index, indexSize);
+    free(index);
+}
+
+int runCorpus(const corpusjob_t* job) {
+    struct stat st;
+
+    if (stat(job->path, &st) != 0) {
+        printf("Couldn't open corpus `%s`. Exiting...\n", job->path);
+        exit(1);
+    }
+
+    corpus_root = job->path;
+
+    if (S_ISDIR(st.st_mode)) {
+        scanDirectory("");
+    } else {
+        size_t size = 0;
+        const uint8_t* data = mapFile(job->path, &size);
+
+        if (data == NULL) {
+            printf("Couldn't map corpus `%s`. Exiting...\n", job->path);
+            exit(1);
+        }
+
+        if (isSid(data, size)) {
+            const char* base = strrchr(job->path, '/');
+            addEntry(base ? base + 1 : job->path, data, size);
+        } else {
+            scanArchive(data, size);
+        }
+    }
+
+    printf("Corpus: %d SID files\n", entry_count);
+
+    if (job->store != NULL) { storeOpen(job->store); }
+
+    /* Only tunes with a run missing from the store are handed out */
+    pending = malloc((entry_count > 0 ? entry_count : 1) * sizeof(pending[0]));
+    pending_count = 0;
+
+    for (int i = 0; i < entry_count; i++) {
+        if (job->store == NULL || !job->diffs || !storedTune(job, (uint32_t)i)) { pending[pending_count++] = (uint32_t)i; }
+    }
+
+    if (pending_count < entry_count) { printf("Corpus: %d SID files found in store\n", entry_count - pending_count); }
+
+    if (!job->overwrite && access(job->output, F_OK) == 0) {
+        printf("Output file `%s` already exists. Exiting...\n", job->output);
+        exit(1);
+    }
+
+    FILE* tar = createFile(job->output, "wb");
+
+    if (!tar) {
+        printf("Couldn't create output file `%s`. Exiting...\n", job->output);
+        exit(1);
+    }
+
+    static char tarbuffer[1 << 20];
+    setvbuf(tar, tarbuffer, _IOFBF, sizeof(tarbuffer));
+
+    shared = mmap(NULL, sizeof(corpusshared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared == MAP_FAILED || sem_init(&shared->ready, 1, 0) != 0) {
+        printf("Couldn't set up the worker queue. Exiting...\n");
+        exit(1);
+    }
+
+    shared->next = 0;
+
+    int workerCount = job->workers;
+    if (workerCount > pending_count) { workerCount = pending_count > 0 ? pending_count : 1; }
+
+    corpusworker_t* workers = calloc(workerCount, sizeof(corpusworker_t));
+
+    for (int i = 0; i < workerCount; i++) {
+        workers[i].ring = mmap(NULL, sizeof(resultring_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+        if (workers[i].ring == MAP_FAILED) {
+            printf("Couldn't map a result ring. Exiting...\n");
+            exit(1);
+        }
+
+        workers[i].pid = startWorker(job, workers[i].ring);
+        workers[i].entry = -1;
+        workers[i].progress = now();
+    }
+
+    int running = workerCount;
+    int restarts = 0;
+
+    while (running > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += CORPUSPOLL * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        /* Every ring is drained below, so the posts so far are all taken */
+        if (sem_timedwait(&shared->ready, &ts) == 0) {
+            while (sem_trywait(&shared->ready) == 0) {}
+        }
+
+        double time = now();
+
+        for (int i = 0; i < workerCount; i++) {
+            corpusworker_t* w = &workers[i];
+            if (w->pid == 0) { continue; }
+
+            drainRing(tar, job, w->ring);
+            checkWorker(job, w, time);
+
+            int wstatus = 0;
+            if (waitpid(w->pid, &wstatus, WNOHANG) != w->pid) { continue; }
+
+            /* A replacement takes over the queue while there's work left */
+            if (buryWorker(tar, job, w, i, wstatus) && __atomic_load_n(&shared->next, __ATOMIC_RELAXED) < (uint32_t)pending_count) {
+                w->pid = startWorker(job, w->ring);
+                w->killed = 0;
+                w->entry = -1;
+                w->progress = now();
+                restarts++;
+                continue;
+            }
+
+            w->pid = 0;
+            running--;
+        }
+
+        if (telemetry_enabled) { telemetryCorpus((int)shared->next + entry_count - pending_count, entry_count, result_count, false); }
+    }
+
+    if (restarts > 0) { printf("Corpus: %d workers restarted\n", restarts); }
+
+    if (telemetry_enabled) { telemetryCorpus(entry_count, entry_count, result_count, true); }
+
+    writeIndex(tar);
+
+    uint8_t end[TARBLOCK * 2] = { 0 };
+    fwrite(end, 1, sizeof(end), tar);
+    fclose(tar);
+
+    printf("Corpus results: %d runs written to `%s`\n", result_count, job->output);
+
+    for (int i = 0; i < workerCount; i++) { munmap(workers[i].ring, sizeof(resultring_t)); }
+
+    sem_destroy(&shared->ready);
+    munmap(shared, sizeof(corpusshared_t));
+    free(workers);
+    free(pending);
+
+    return 0;
+}
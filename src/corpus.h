@@ -0,0 +1,39 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include "sidulator.h"
+
+#define MAXCORPUSFRAMES 64
+
+/*
+ * Corpus mode runs every subtune of every SID in a directory tree or an
+ * uncompressed tar archive, spread over forked worker processes. Results
+ * are streamed into a single tar container: one `<sid>/<subtune>/<frame>.diff`
+ * per fixed time when diffs are asked for, and an `index.tsv` with the
+ * state fingerprint and the longest frame in cycles for every run. With a
+ * diff store the diffs are deduplicated into the store instead, and a tune
+ * with every run already in the store is taken from it without playing.
+ *
+ * Workers take entries off a counter in shared memory and copy their
+ * records into a ring of their own, also shared, which the parent reads in
+ * place. The parent supervises them: a worker that dies, goes over the
+ * cycle budget on one tune or stops making progress has that tune marked
+ * in the index and is replaced by a fresh one while entries are left.
+ */
+typedef struct {
+    const char* path;
+    const char* output;
+    bool overwrite;
+    bool diffs;
+    int workers;
+    int frames[MAXCORPUSFRAMES];     /* ascending */
+    int frameCount;
+    const char* includeRegions;
+    const char* store;               /* diffs go to this store instead of the container */
+    uint64_t optionsKey;
+    uint64_t tuneCycles;             /* a worker over this on one tune is killed, 0 for no limit */
+} corpusjob_t;
+
+int runCorpus(const corpusjob_t* job);
+
+#endif
@@ -0,0 +1,153 @@
+#include <string.h>
+
+#include "delta.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DELTA_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    deltarun_t* runs;
+    int count;
+} runs_t;
+
+/* Appends the set bits of a 64 byte block's difference mask as runs,
+   joining the last run when it continues from the previous block */
+static inline void addMask(runs_t* r, uint32_t base, uint64_t mask) {
+    while (mask != 0) {
+        int start = __builtin_ctzll(mask);
+        uint64_t rest = ~(mask >> start);
+        int length = rest == 0 ? 64 : __builtin_ctzll(rest);
+        uint32_t addr = base + start;
+
+        deltarun_t* last = r->count > 0 ? &r->runs[r->count - 1] : NULL;
+
+        if (last != NULL && last->addr + last->length == addr) {
+            last->length += length;
+        } else {
+            r->runs[r->count].addr = addr;
+            r->runs[r->count].length = length;
+            r->count++;
+        }
+
+        mask = start + length >= 64 ? 0 : mask & (~0ULL << (start + length));
+    }
+}
+
+static int runsScalar(const uint8_t* from, const uint8_t* to, deltarun_t* runs) {
+    runs_t r = { runs, 0 };
+
+    for (uint32_t base = 0; base < MEMSIZE; base += 64) {
+        uint64_t mask = 0;
+
+        for (int w = 0; w < 64; w += 8) {
+            uint64_t a, b;
+            memcpy(&a, from + base + w, 8);
+            memcpy(&b, to + base + w, 8);
+
+            if (a == b) { continue; }
+
+            for (int i = 0; i < 8; i++) {
+                if (from[base + w + i] != to[base + w + i]) { mask |= 1ULL << (w + i); }
+            }
+        }
+
+        if (mask != 0) { addMask(&r, base, mask); }
+    }
+
+    return r.count;
+}
+
+#ifdef DELTA_X86
+__attribute__((target("sse2")))
+static int runsSSE2(const uint8_t* from, const uint8_t* to, deltarun_t* runs) {
+    runs_t r = { runs, 0 };
+
+    for (uint32_t base = 0; base < MEMSIZE; base += 64) {
+        uint64_t equal = 0;
+
+        for (int w = 0; w < 64; w += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(from + base + w));
+            __m128i b = _mm_loadu_si128((const __m128i*)(to + base + w));
+
+            equal |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) << w;
+        }
+
+        if (equal != ~0ULL) { addMask(&r, base, ~equal); }
+    }
+
+    return r.count;
+}
+
+__attribute__((target("avx2")))
+static int runsAVX2(const uint8_t* from, const uint8_t* to, deltarun_t* runs) {
+    runs_t r = { runs, 0 };
+
+    for (uint32_t base = 0; base < MEMSIZE; base += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(from + base));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(to + base));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(from + base + 32));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(to + base + 32));
+
+        uint64_t equal = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0)) |
+                         (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1)) << 32;
+
+        if (equal != ~0ULL) { addMask(&r, base, ~equal); }
+    }
+
+    return r.count;
+}
+#endif
+
+typedef int (*deltafunc_t)(const uint8_t* from, const uint8_t* to, deltarun_t* runs);
+
+static deltafunc_t delta_func = NULL;
+static const char* delta_name = NULL;
+
+static void selectImplementation() {
+    delta_func = runsScalar;
+    delta_name = "scalar";
+
+#ifdef DELTA_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        delta_func = runsAVX2;
+        delta_name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        delta_func = runsSSE2;
+        delta_name = "SSE2";
+    }
+#endif
+}
+
+/* Returns the number of runs, runs must have room for MAXDELTARUNS */
+int deltaRuns(const uint8_t* from, const uint8_t* to, deltarun_t* runs) {
+    if (delta_func == NULL) { selectImplementation(); }
+
+    return delta_func(from, to, runs);
+}
+
+/* Sets changes to 1 for differing bytes and 0 elsewhere, returns how many differ */
+int deltaChanges(const uint8_t* from, const uint8_t* to, uint8_t* changes) {
+    static deltarun_t runs[MAXDELTARUNS];
+
+    int count = deltaRuns(from, to, runs);
+    int total = 0;
+
+    memset(changes, 0, MEMSIZE);
+
+    for (int i = 0; i < count; i++) {
+        memset(changes + runs[i].addr, 1, runs[i].length);
+        total += runs[i].length;
+    }
+
+    return total;
+}
+
+const char* deltaImplementation() {
+    if (delta_func == NULL) { selectImplementation(); }
+
+    return delta_name;
+}
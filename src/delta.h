@@ -0,0 +1,24 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "sidulator.h"
+
+/*
+ * True deltas between two 64 KB images: only bytes whose value differs,
+ * unlike memory_changes[] which also has bytes rewritten with the same
+ * value. The images are compared 32 or 64 bytes at a time with AVX2 or
+ * SSE2 when the CPU has them, picked at runtime, or 8 bytes at a time
+ * otherwise. The difference masks go straight into address runs.
+ */
+typedef struct {
+    uint32_t addr;
+    uint32_t length;
+} deltarun_t;
+
+#define MAXDELTARUNS (MEMSIZE / 2)
+
+int deltaRuns(const uint8_t* from, const uint8_t* to, deltarun_t* runs);
+int deltaChanges(const uint8_t* from, const uint8_t* to, uint8_t* changes);
+const char* deltaImplementation();
+
+#endif
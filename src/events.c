@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "events.h"
+#include "audio.h"
+
+/* Spins before sleeping when the ring is empty or full */
+#define EVENTSPIN 256
+#define EVENTSLEEP 50000              /* ns */
+
+bool events_enabled = false;
+
+/* Head and tail on their own cache lines, each side caches the other's */
+static struct {
+    event_t slots[EVENTRING];
+
+    uint32_t head __attribute__((aligned(64)));         /* written by the producer */
+    uint32_t tailCache;
+
+    uint32_t tail __attribute__((aligned(64)));         /* written by the consumer */
+    uint32_t headCache;
+} ring;
+
+static pthread_t consumer;
+static FILE* events_file = NULL;
+static uint64_t producer_waits = 0;
+
+static void backoff(int* spins) {
+    if (++*spins < EVENTSPIN) {
+        sched_yield();
+        return;
+    }
+
+    struct timespec ts = { 0, EVENTSLEEP };
+    nanosleep(&ts, NULL);
+}
+
+void eventsPush(uint8_t type, uint64_t cycle, uint32_t frame, uint8_t reg, uint8_t value) {
+    uint32_t head = ring.head;
+
+    if (head - ring.tailCache == EVENTRING) {
+        int spins = 0;
+
+        while (head - (ring.tailCache = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE)) == EVENTRING) {
+            if (spins == 0) { producer_waits++; }
+            backoff(&spins);
+        }
+    }
+
+    event_t* e = &ring.slots[head & (EVENTRING - 1)];
+    e->cycle = cycle;
+    e->frame = frame;
+    e->type = type;
+    e->reg = reg;
+    e->value = value;
+
+    __atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Writes the log: `w <cycle> <reg> <value>` per write, `f <frame> <cycle>`
+   per frame end and `s <frame>` with all registers per snapshot, and
+   feeds the audio renderer */
+static void* consume(void* arg) {
+    (void)arg;
+
+    uint8_t shadow[0x20] = { 0 };
+    uint32_t tail = ring.tail;
+
+    for (;;) {
+        int spins = 0;
+
+        while (tail == ring.headCache) {
+            ring.headCache = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+            if (tail == ring.headCache) { backoff(&spins); }
+        }
+
+        /* Everything published so far, then one release for the batch */
+        while (tail != ring.headCache) {
+            const event_t* e = &ring.slots[tail & (EVENTRING - 1)];
+
+            switch (e->type) {
+                case EVENT_WRITE:
+                    shadow[e->reg] = e->value;
+                    if (events_file) { fprintf(events_file, "w %llu %02x %02x\n", (unsigned long long)e->cycle, e->reg, e->value); }
+                    if (audio_enabled) { audioWrite(e->cycle, e->reg, e->value); }
+                    break;
+
+                case EVENT_FRAME:
+                    if (events_file) { fprintf(events_file, "f %u %llu\n", e->frame, (unsigned long long)e->cycle); }
+                    if (audio_enabled) { audioFrame(e->cycle); }
+                    break;
+
+                case EVENT_SNAPSHOT:
+                    if (!events_file) { break; }
+                    fprintf(events_file, "s %u", e->frame);
+                    for (int i = 0; i < 0x19; i++) { fprintf(events_file, " %02x", shadow[i]); }
+                    fputc('\n', events_file);
+                    break;
+
+                case EVENT_END:
+                    __atomic_store_n(&ring.tail, tail + 1, __ATOMIC_RELEASE);
+                    return NULL;
+            }
+
+            tail++;
+        }
+
+        __atomic_store_n(&ring.tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void openLog(const char* filename, bool overwrite) {
+    if (!overwrite && access(filename, F_OK) == 0) {
+        printf("SID log `%s` already exists. Exiting...\n", filename);
+        exit(1);
+    }
+
+    events_file = createFile(filename, "w");
+
+    if (events_file == NULL) {
+        printf("Couldn't create SID log `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(events_file, buffer, _IOFBF, sizeof(buffer));
+}
+
+/* filename is NULL when the events only feed the audio renderer */
+void eventsOpen(const char* filename, bool overwrite) {
+    if (filename != NULL) { openLog(filename, overwrite); }
+
+    ring.head = ring.tail = 0;
+    ring.headCache = ring.tailCache = 0;
+
+    if (pthread_create(&consumer, NULL, consume, NULL) != 0) {
+        printf("Couldn't start the SID log thread. Exiting...\n");
+        exit(1);
+    }
+
+    events_enabled = true;
+}
+
+void eventsClose() {
+    if (!events_enabled) { return; }
+
+    eventsPush(EVENT_END, 0, 0, 0, 0);
+    pthread_join(consumer, NULL);
+
+    if (events_file != NULL) { fclose(events_file); }
+    audioClose();
+
+    events_file = NULL;
+    events_enabled = false;
+
+    verbose("SID log: producer waited on a full ring %llu times\n", (unsigned long long)producer_waits);
+}
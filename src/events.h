@@ -0,0 +1,41 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "sidulator.h"
+
+/*
+ * Events from the CPU to consumer threads: SID register writes stamped
+ * with the cycle their instruction started on, frame ends, and snapshot
+ * requests. playMusic() only pushes into a single-producer/single-consumer
+ * lock-free ring. A consumer thread drains it and does the slow part, so
+ * formatting and file I/O overlap with emulation. A full ring makes the
+ * producer wait, so a slow consumer can't make memory grow.
+ *
+ * The consumer keeps a shadow of the SID registers built from the writes.
+ * A snapshot request makes it dump the shadow. The writes and frame ends
+ * also feed the audio renderer of audio.h when it's open.
+ */
+#define EVENTRING (1 << 16)           /* events, a power of two */
+
+enum {
+    EVENT_WRITE,                      /* reg, value */
+    EVENT_FRAME,                      /* frame that ended */
+    EVENT_SNAPSHOT,                   /* frame the registers are dumped at */
+    EVENT_END
+};
+
+typedef struct {
+    uint64_t cycle;
+    uint32_t frame;
+    uint8_t type;
+    uint8_t reg;
+    uint8_t value;
+} event_t;
+
+extern bool events_enabled;
+
+void eventsOpen(const char* filename, bool overwrite);
+void eventsPush(uint8_t type, uint64_t cycle, uint32_t frame, uint8_t reg, uint8_t value);
+void eventsClose();
+
+#endif
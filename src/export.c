@@ -0,0 +1,381 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+
+#define STUBSIZE 8
+
+#define CYCLESPERLINE 63         /* PAL */
+
+/* jsr + jmp entry + re-pointing the jmp + lda #remaining + rts */
+#define CHUNKOVERHEAD (6 + 3 + 12 + 2 + 6)
+
+#define IOSTART 0xd000
+#define IOEND 0xe000
+
+enum {
+    USE_FREE,
+    USE_TUNE,                   /* tune data */
+    USE_PLAY,                   /* written by the tune */
+    USE_DIFF,                   /* written by the diff routine */
+    USE_IO
+};
+
+static const char* useName(int use) {
+    switch (use) {
+        case USE_TUNE: return "tune data";
+        case USE_PLAY: return "memory written by the tune";
+        case USE_DIFF: return "memory written by the diff";
+        case USE_IO: return "I/O area";
+    }
+
+    return "free";
+}
+
+int exportFormat(const char* name) {
+    if (strcmp(name, "diff") == 0) { return EXPORT_DIFF; }
+    if (strcmp(name, "prg") == 0) { return EXPORT_PRG; }
+    if (strcmp(name, "psid") == 0) { return EXPORT_PSID; }
+    if (strcmp(name, "chunked") == 0) { return EXPORT_CHUNKED; }
+
+    printf("Unknown output format `%s` (diff, prg, psid or chunked). Exiting...\n", name);
+    exit(1);
+}
+
+static int memoryUse(const exportjob_t* job, const uint8_t* changes, uint32_t addr) {
+    if (addr >= IOSTART && addr < IOEND) { return USE_IO; }
+    if (addr >= job->tuneStart && addr < job->tuneStart + job->tuneSize) { return USE_TUNE; }
+    if (changes[addr]) { return USE_DIFF; }
+    if (job->used != NULL && job->used[addr]) { return USE_PLAY; }
+
+    return USE_FREE;
+}
+
+static bool spanFree(const exportjob_t* job, const uint8_t* changes, uint32_t start, uint32_t size) {
+    if (start + size > MEMSIZE) { return false; }
+
+    for (uint32_t addr = start; addr < start + size; addr++) {
+        if (memoryUse(job, changes, addr) != USE_FREE) { return false; }
+    }
+
+    return true;
+}
+
+/* Right after the tune, right before it, then the first free page from $0400 */
+static int findSpace(const exportjob_t* job, const uint8_t* changes, uint32_t size) {
+    uint32_t end = job->tuneStart + job->tuneSize;
+
+    if (spanFree(job, changes, end, size)) { return (int)end; }
+    if (job->tuneStart >= size && spanFree(job, changes, job->tuneStart - size, size)) { return job->tuneStart - size; }
+
+    for (uint32_t addr = 0x0400; addr + size <= IOSTART; addr += 256) {
+        if (spanFree(job, changes, addr, size)) { return (int)addr; }
+    }
+
+    return -1;
+}
+
+/* Prints the conflicting ranges, returns their total size */
+static uint32_t reportConflicts(const exportjob_t* job, const uint8_t* changes, uint32_t start, uint32_t size) {
+    uint32_t conflicts = 0;
+    uint32_t addr = start;
+
+    while (addr < start + size) {
+        if (addr >= MEMSIZE) {
+            printf("\tConflict: $%04x-$%04x past the end of memory\n", addr, start + size - 1);
+            return conflicts + (start + size - addr);
+        }
+
+        int use = memoryUse(job, changes, addr);
+        uint32_t from = addr;
+        while (addr < start + size && addr < MEMSIZE && memoryUse(job, changes, addr) == use) { addr++; }
+
+        if (use != USE_FREE) {
+            printf("\tConflict: $%04x-$%04x overlaps %s\n", from, addr - 1, useName(use));
+            conflicts += addr - from;
+        }
+    }
+
+    return conflicts;
+}
+
+static void putBE16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 255;
+}
+
+static void writePsid(FILE* fp, const exportjob_t* job, uint16_t address, const uint8_t* diff, size_t diffSize) {
+    const psid_t* psid = job->psid;
+
+    uint8_t header[0x7c] = { 'P', 'S', 'I', 'D' };
+
+    uint16_t init = address;
+    uint16_t routine = address + STUBSIZE;
+    uint32_t footprintEnd = address + STUBSIZE + diffSize;
+
+    uint32_t start = job->tuneStart < address ? job->tuneStart : address;
+    uint32_t end = job->tuneStart + job->tuneSize > footprintEnd ? job->tuneStart + job->tuneSize : footprintEnd;
+
+    putBE16(header + 0x04, 2);
+    putBE16(header + 0x06, sizeof(header));
+    putBE16(header + 0x08, 0);               /* load address in the data */
+    putBE16(header + 0x0a, init);
+    putBE16(header + 0x0c, psid->playAddress);
+    putBE16(header + 0x0e, 1);
+    putBE16(header + 0x10, 1);
+
+    putBE16(header + 0x76, psid->flags);
+
+    /* The speed bit of the chosen subtune moves to song 1 */
+    int bit = job->subtune - 1 < 32 ? job->subtune - 1 : 31;
+    header[0x15] = (psid->speed >> bit) & 1;
+
+    memcpy(header + 0x16, psid->name, 32);
+    memcpy(header + 0x36, psid->author, 32);
+    memcpy(header + 0x56, psid->released, 32);
+
+    const uint8_t stub[STUBSIZE] = {
+        0xa9, (uint8_t)(job->subtune - 1),                    /* lda #subtune */
+        0x20, psid->initAddress & 255, psid->initAddress >> 8, /* jsr init     */
+        0x4c, routine & 255, routine >> 8,                     /* jmp diff     */
+    };
+
+    uint8_t* data = calloc(1, end - start);
+
+    memcpy(data + (job->tuneStart - start), psid->data, job->tuneSize);
+    memcpy(data + (address - start), stub, sizeof(stub));
+    memcpy(data + (routine - start), diff, diffSize);
+
+    uint8_t load[] = { start & 255, start >> 8 };
+
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(load, 1, sizeof(load), fp);
+    fwrite(data, 1, end - start, fp);
+
+    free(data);
+
+    printf("PSID load block $%04x-$%04x, init $%04x, play $%04x, subtune %d\n",
+           start, end - 1, init, psid->playAddress, job->subtune);
+}
+
+typedef struct {
+    uint16_t addr;
+    uint8_t value;
+    uint8_t late;               /* on a page the play routine reads */
+} store_t;
+
+static int compareStores(const void* a, const void* b) {
+    const store_t* sa = a;
+    const store_t* sb = b;
+
+    if (sa->late != sb->late) { return sa->late - sb->late; }
+    if (sa->value != sb->value) { return sa->value - sb->value; }
+
+    return sa->addr - sb->addr;
+}
+
+/* Assembles the chunked routine at base into out (when not NULL) and
+   returns its size. Stores on pages the play routine reads all go in one
+   final chunk, so play never runs on half of them. */
+static size_t chunkRoutine(const exportjob_t* job, const uint8_t* values, const uint8_t* changes,
+                           uint16_t base, uint8_t* out, bool report) {
+    static store_t stores[MEMSIZE];
+    static uint32_t chunkStart[MEMSIZE + 1];
+
+    bool latePage[256] = { false };
+
+    if (job->access != NULL) {
+        for (uint32_t i = 0; i < MEMSIZE; i++) {
+            if (job->access[i] & ACCESS_READ) { latePage[i >> 8] = true; }
+        }
+    }
+
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < MEMSIZE; i++) {
+        if (changes[i] == 0) { continue; }
+
+        stores[count].addr = (uint16_t)i;
+        stores[count].value = values[i];
+        stores[count].late = latePage[i >> 8];
+        count++;
+    }
+
+    qsort(stores, count, sizeof(store_t), compareStores);
+
+    /* Greedy split, every chunk starts with LDX and each value change costs
+       an LDX or INX, both two cycles */
+    uint32_t budget = (uint32_t)job->chunkLines * CYCLESPERLINE;
+    uint32_t chunks = 0;
+    uint32_t cycles = 0;
+
+    if (budget < CHUNKOVERHEAD + 2 + 4) {
+        printf("%d raster lines can't fit a single store. Exiting...\n", job->chunkLines);
+        exit(1);
+    }
+
+    for (uint32_t n = 0; n < count; n++) {
+        bool newValue = n == 0 || stores[n].value != stores[n - 1].value;
+        bool newChunk = chunks == 0 || stores[n].late != stores[n - 1].late;
+
+        if (!newChunk && !stores[n].late && cycles + (newValue ? 2 : 0) + 4 > budget) { newChunk = true; }
+
+        if (newChunk) {
+            chunkStart[chunks++] = n;
+            cycles = CHUNKOVERHEAD + 2 + 4;
+        } else {
+            cycles += (newValue ? 2 : 0) + 4;
+        }
+    }
+
+    chunkStart[chunks] = count;
+
+    if (count > 0 && stores[count - 1].late && cycles > budget) {
+        printf("The %u stores on pages read by play take %.1f raster lines, more than the %d of a chunk, raise --chunklines. Exiting...\n",
+               count - chunkStart[chunks - 1], (double)cycles / CYCLESPERLINE, job->chunkLines);
+        exit(1);
+    }
+
+    /* entry: jmp chunk, each chunk re-points it to the next one */
+    size_t size = 0;
+
+#define EMIT(...) do { \
+        const uint8_t bytes[] = { __VA_ARGS__ }; \
+        if (out != NULL) { memcpy(out + size, bytes, sizeof(bytes)); } \
+        size += sizeof(bytes); \
+    } while (0)
+
+    uint16_t entry = base;
+    EMIT(0x4c, 0x00, 0x00);
+
+    for (uint32_t c = 0; c < chunks; c++) {
+        uint16_t chunkAddress = (uint16_t)(base + size);
+        uint32_t chunkCycles = CHUNKOVERHEAD;
+        uint8_t previous = 0;
+
+        if (c == 0 && out != NULL) {
+            out[1] = chunkAddress & 255;
+            out[2] = chunkAddress >> 8;
+        }
+
+        for (uint32_t n = chunkStart[c]; n < chunkStart[c + 1]; n++) {
+            uint8_t value = stores[n].value;
+
+            if (n == chunkStart[c] || value != previous) {
+                if (n != chunkStart[c] && value == (uint8_t)(previous + 1)) {
+                    EMIT(0xe8);                                 /* inx      */
+                } else {
+                    EMIT(0xa2, value);                          /* ldx #v   */
+                }
+
+                chunkCycles += 2;
+            }
+
+            EMIT(0x8e, stores[n].addr & 255, stores[n].addr >> 8);  /* stx addr */
+            chunkCycles += 4;
+            previous = value;
+        }
+
+        /* The next chunk's address is only known once this one is laid out */
+        size_t patch = size;
+        EMIT(0xa9, 0x00, 0x8d, (entry + 1) & 255, (entry + 1) >> 8,  /* lda #<next, sta entry+1 */
+             0xa9, 0x00, 0x8d, (entry + 2) & 255, (entry + 2) >> 8,  /* lda #>next, sta entry+2 */
+             0xa9, (uint8_t)(chunks - c - 1),                       /* lda #remaining */
+             0x60);                                                 /* rts */
+
+        if (out != NULL) {
+            uint16_t next = (uint16_t)(base + size);
+            out[patch + 1] = next & 255;
+            out[patch + 6] = next >> 8;
+        }
+
+        if (report) {
+            printf("\tChunk %u: %u stores, %u cycles, %.1f raster lines%s\n", c + 1,
+                   chunkStart[c + 1] - chunkStart[c], chunkCycles, (double)chunkCycles / CYCLESPERLINE,
+                   stores[chunkStart[c]].late ? ", pages read by play" : "");
+        }
+    }
+
+    /* done: every later call is a no-op returning zero */
+    EMIT(0xa9, 0x00, 0x60);
+
+#undef EMIT
+
+    if (report) {
+        printf("Diff split into %u chunks of at most %u cycles, call entry once per frame until it returns 0\n",
+               chunks, budget);
+    }
+
+    return size;
+}
+
+void exportDiff(const char* filename, bool overwrite, const exportjob_t* job, const uint8_t* values, const uint8_t* changes) {
+    char* diff = NULL;
+    size_t diffSize = 0;
+
+    if (job->format == EXPORT_CHUNKED) {
+        diffSize = chunkRoutine(job, values, changes, 0, NULL, false);
+    } else {
+        FILE* mem = open_memstream(&diff, &diffSize);
+        writeStandaloneDiff(mem, values, changes);
+        fclose(mem);
+    }
+
+    uint32_t size = (uint32_t)diffSize + (job->format == EXPORT_PSID ? STUBSIZE : 0);
+    int address = job->address;
+
+    if (address < 0) {
+        address = findSpace(job, changes, size);
+
+        if (address < 0) {
+            printf("No free space for %u bytes of diff routine. Exiting...\n", size);
+            exit(1);
+        }
+    }
+
+    printf("Footprint: $%04x-$%04x, %u bytes", address, address + size - 1, size);
+    if (job->format == EXPORT_PSID) { printf(" (%d bytes init stub)", STUBSIZE); }
+    putchar('\n');
+
+    uint32_t conflicts = reportConflicts(job, changes, (uint32_t)address, size);
+
+    if (conflicts > 0) {
+        printf("%u bytes in conflict with the tune, choose another address. Exiting...\n", conflicts);
+        exit(1);
+    }
+
+    if (job->format == EXPORT_CHUNKED) {
+        diff = malloc(diffSize);
+        chunkRoutine(job, values, changes, (uint16_t)address, (uint8_t*)diff, true);
+    }
+
+    FILE* fp = NULL;
+
+    if (!overwrite && (fp = fopen(filename, "rb")) != NULL) {
+        printf("Output file `%s` already exists. Exiting...\n", filename);
+        fclose(fp);
+        exit(1);
+    }
+
+    fp = createFile(filename, "wb");
+
+    if (!fp) {
+        printf("Couldn't create output file `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    if (job->format == EXPORT_PSID) {
+        writePsid(fp, job, (uint16_t)address, (const uint8_t*)diff, diffSize);
+    } else {
+        uint8_t load[] = { address & 255, address >> 8 };
+
+        fwrite(load, 1, sizeof(load), fp);
+        fwrite(diff, 1, diffSize, fp);
+    }
+
+    fclose(fp);
+    free(diff);
+}
@@ -0,0 +1,43 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "sidulator.h"
+#include "psid.h"
+
+enum {
+    EXPORT_DIFF,                /* bare RTS-terminated routine */
+    EXPORT_PRG,                 /* the routine with a load address */
+    EXPORT_PSID,                /* the tune with an init that applies the routine */
+    EXPORT_CHUNKED              /* a PRG applying the diff a few raster lines per call */
+};
+
+/*
+ * Ready-to-play output. The diff routine only uses LDX/INX/STX/RTS, so it
+ * runs from wherever it's loaded. A PSID gets a small init stub in front of
+ * the routine: `lda #subtune-1; jsr init; jmp diff`, which leaves the tune
+ * at the chosen position for the first play call. The tune data and the
+ * routine are merged into one load block, the gap between them zero-filled
+ * like the emulated memory was.
+ *
+ * The chunked routine is called once per frame from its first byte and
+ * returns the number of chunks still to go in A, zero when the state is
+ * complete. Each call stays within chunkLines raster lines. The stores
+ * on pages the play routine reads are applied together by the last call,
+ * and an export whose late stores don't fit one call fails.
+ */
+typedef struct {
+    int format;
+    int address;                /* where the routine goes, -1 picks a free spot */
+    uint16_t tuneStart;         /* tune image as it was loaded */
+    uint32_t tuneSize;
+    const uint8_t* used;        /* addresses the tune wrote while playing */
+    const psid_t* psid;         /* EXPORT_PSID only */
+    int subtune;                /* EXPORT_PSID only, 1-based */
+    int chunkLines;             /* EXPORT_CHUNKED only */
+    const uint8_t* access;      /* EXPORT_CHUNKED, observeAccess() past the position */
+} exportjob_t;
+
+int exportFormat(const char* name);
+void exportDiff(const char* filename, bool overwrite, const exportjob_t* job, const uint8_t* values, const uint8_t* changes);
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "find.h"
+
+bool find_enabled = false;
+
+static uint8_t find_dump[MEMSIZE];
+static uint8_t find_mask[MEMSIZE];
+static uint16_t find_addrs[MEMSIZE];
+static uint32_t find_addrcount = 0;
+static uint16_t find_counter = 0;
+
+static uint64_t find_target = 0;        /* masked fingerprint of the dump */
+static uint64_t find_masked = 0;        /* masked fingerprint of memory */
+static uint64_t find_state = 0;         /* memory fingerprint without the frame counter */
+
+static int find_matches[MAXFINDMATCHES];
+static int find_matchcount = 0;
+static uint64_t find_hits = 0;          /* fingerprint hits, confirmed or not */
+static int find_loopstart = 0;
+static int find_period = 0;
+static int find_collisions = 0;        /* state fingerprints that came back without the state */
+
+/* Frames seen so far by state fingerprint, open addressing, frame 0 is empty */
+typedef struct {
+    uint64_t key;
+    int frame;
+} findslot_t;
+
+static findslot_t* find_seen = NULL;
+static uint32_t find_seensize = 0;
+static uint32_t find_seencount = 0;
+
+static inline uint64_t findMix(uint32_t addr, uint8_t value) {
+    uint64_t z = (((uint64_t)addr << 8) | value) * 0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static bool isCounter(uint32_t addr) {
+    return addr >= find_counter && addr < (uint32_t)find_counter + 4;
+}
+
+/* A raw 64KB image, or a 64KB PRG saved from $0000 as a monitor writes it */
+static void loadDump(const char* filename) {
+    static uint8_t file[MEMSIZE + 3];
+
+    FILE* fp = fopen(filename, "rb");
+
+    if (!fp) {
+        printf("Couldn't open dump `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    size_t size = fread(file, 1, sizeof(file), fp);
+    fclose(fp);
+
+    if (size == MEMSIZE) {
+        memcpy(find_dump, file, MEMSIZE);
+    } else if (size == MEMSIZE + 2 && file[0] == 0x00 && file[1] == 0x00) {
+        memcpy(find_dump, file + 2, MEMSIZE);
+    } else {
+        printf("Dump `%s` isn't a 64KB image or a PRG from $0000. Exiting...\n", filename);
+        exit(1);
+    }
+}
+
+static void parseMask(const char* regions) {
+    const char* at = regions;
+
+    while (*at != '\0') {
+        char* end = NULL;
+        long s = strtol(at, &end, 0);
+        long e = s;
+
+        if (end == at) { break; }
+        if (*end == '-') { at = end + 1; e = strtol(at, &end, 0); }
+
+        if (s > e) { long t = s; s = e; e = t; }
+        if (s < 0 || e >= MEMSIZE) {
+            printf("Mask region `%s` out of range. Exiting...\n", regions);
+            exit(1);
+        }
+
+        verbose("Find mask 0x%04lx - 0x%04lx\n", s, e);
+        memset(find_mask + s, 1, e - s + 1);
+
+        at = end;
+        if (*at == ',') { at++; } else { break; }
+    }
+
+    if (*at != '\0') {
+        printf("Bad mask `%s` at `%s`. Exiting...\n", regions, at);
+        exit(1);
+    }
+}
+
+void findBegin(const char* dumpFilename, const char* maskRegions, uint16_t frameCounterAddress) {
+    loadDump(dumpFilename);
+
+    memset(find_mask, 0, sizeof(find_mask));
+    parseMask(maskRegions);
+
+    find_counter = frameCounterAddress;
+    find_addrcount = 0;
+    find_target = find_masked = find_state = 0;
+
+    for (uint32_t i = 0; i < MEMSIZE; i++) {
+        if (find_mask[i]) {
+            find_addrs[find_addrcount++] = (uint16_t)i;
+            find_target += findMix(i, find_dump[i]);
+            find_masked += findMix(i, memory[i]);
+        }
+
+        if (!isCounter(i)) { find_state += findMix(i, memory[i]); }
+    }
+
+    if (find_addrcount == 0) {
+        printf("Empty find mask. Exiting...\n");
+        exit(1);
+    }
+
+    find_seensize = 1 << 16;
+    find_seencount = 0;
+    find_seen = calloc(find_seensize, sizeof(findslot_t));
+
+    find_matchcount = 0;
+    find_hits = 0;
+    find_loopstart = find_period = find_collisions = 0;
+    find_enabled = true;
+
+    verbose("Find: %u masked bytes\n", find_addrcount);
+}
+
+void findWrite(uint16_t addr, uint8_t value) {
+    uint8_t old = memory[addr];
+
+    if (old == value) { return; }
+
+    uint64_t delta = findMix(addr, value) - findMix(addr, old);
+
+    if (find_mask[addr]) { find_masked += delta; }
+    if (!isCounter(addr)) { find_state += delta; }
+}
+
+static bool confirmMatch() {
+    for (uint32_t i = 0; i < find_addrcount; i++) {
+        if (memory[find_addrs[i]] != find_dump[find_addrs[i]]) { return false; }
+    }
+
+    return true;
+}
+
+/* Returns the frame the state was first seen at, or 0 after adding it */
+static int seenFrame(uint64_t key, int frame) {
+    if (find_seencount * 2 >= find_seensize) {
+        findslot_t* old = find_seen;
+        uint32_t oldsize = find_seensize;
+
+        find_seensize *= 2;
+        find_seen = calloc(find_seensize, sizeof(findslot_t));
+
+        for (uint32_t i = 0; i < oldsize; i++) {
+            if (old[i].frame == 0) { continue; }
+
+            uint32_t slot = (uint32_t)old[i].key & (find_seensize - 1);
+            while (find_seen[slot].frame != 0) { slot = (slot + 1) & (find_seensize - 1); }
+            find_seen[slot] = old[i];
+        }
+
+        free(old);
+    }
+
+    uint32_t slot = (uint32_t)key & (find_seensize - 1);
+
+    while (find_seen[slot].frame != 0) {
+        if (find_seen[slot].key == key) { return find_seen[slot].frame; }
+        slot = (slot + 1) & (find_seensize - 1);
+    }
+
+    find_seen[slot].key = key;
+    find_seen[slot].frame = frame;
+    find_seencount++;
+
+    return 0;
+}
+
+static bool checkMatch(int frame) {
+    if (find_masked == find_target) {
+        find_hits++;
+
+        if (confirmMatch()) { find_matches[find_matchcount++] = frame; }
+    }
+
+    return find_matchcount >= MAXFINDMATCHES;
+}
+
+bool findFrameDone(int frame, uint64_t registers) {
+    int first = seenFrame(find_state ^ (registers * 0xff51afd7ed558ccdULL), frame);
+
+    /* A repeated state repeats its matches too, once findLoop() is confirmed */
+    if (first > 0) {
+        find_loopstart = first;
+        find_period = frame - first;
+        return true;
+    }
+
+    return checkMatch(frame);
+}
+
+bool findLoop(int* first, int* repeat) {
+    if (find_period == 0) { return false; }
+
+    *first = find_loopstart;
+    *repeat = find_loopstart + find_period;
+    return true;
+}
+
+bool findLoopRejected(int frame) {
+    find_collisions++;
+    find_loopstart = find_period = 0;
+
+    return checkMatch(frame);
+}
+
+void findReport(int framesPlayed) {
+    find_enabled = false;
+
+    verbose("Find: %llu fingerprint hits, %d confirmed, %u states kept, %d loops rejected\n",
+            (unsigned long long)find_hits, find_matchcount, find_seencount, find_collisions);
+
+    if (find_period > 0) {
+        printf("Tune loops: frame %d repeats frame %d, period %d frames\n",
+               find_loopstart + find_period, find_loopstart, find_period);
+    } else if (framesPlayed >= 0) {
+        printf("No loop found in %d frames\n", framesPlayed);
+    }
+
+    if (find_matchcount == 0) {
+        printf("No frame matches the dump\n");
+    }
+
+    for (int i = 0; i < find_matchcount; i++) {
+        int m = find_matches[i];
+
+        if (find_period > 0 && m >= find_loopstart) {
+            printf("Dump matches frame %d, and every %d frames after it\n", m, find_period);
+        } else {
+            printf("Dump matches frame %d\n", m);
+        }
+    }
+
+    if (find_matchcount >= MAXFINDMATCHES) {
+        printf("Stopped after %d matches\n", MAXFINDMATCHES);
+    }
+
+    free(find_seen);
+    find_seen = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef FIND_H
+#define FIND_H
+
+#include "sidulator.h"
+
+/* Frames searched when no --framecount is given, half an hour at 50 Hz */
+#define FINDFRAMES 90000
+#define MAXFINDMATCHES 16
+
+/*
+ * Reverse lookup of the frame a memory dump was taken at. Two additive
+ * fingerprints, a sum of a mixed (address, value) term per byte, follow
+ * every write: one over the masked addresses, compared against the dump's
+ * every frame, and one over the whole machine state but the driver's frame
+ * counter. A masked fingerprint hit is confirmed by a full compare. The
+ * emulated machine has no inputs, so when the whole state comes back the
+ * tune has looped and no later frame can bring a new match. A state
+ * fingerprint coming back only stops the search; the caller replays the
+ * tune to compare both states in full before findLoop() counts as a loop.
+ */
+extern bool find_enabled;
+
+void findBegin(const char* dumpFilename, const char* maskRegions, uint16_t frameCounterAddress);
+void findWrite(uint16_t addr, uint8_t value);           /* before memory[addr] takes value */
+bool findFrameDone(int frame, uint64_t registers);      /* true once the search can stop */
+bool findLoop(int* first, int* repeat);                 /* the state fingerprint that came back */
+bool findLoopRejected(int frame);                       /* it wasn't the state, true if done anyway */
+void findReport(int framesPlayed);
+
+#endif
@@ -0,0 +1,13 @@
+#include "hash.h"
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* p = data;
+    uint64_t h = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
@@ -0,0 +1,12 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+/* 64-bit FNV-1a, chainable by passing the previous result as seed */
+uint64_t hash64(const void* data, size_t size, uint64_t seed);
+
+#endif
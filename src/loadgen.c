@@ -0,0 +1,347 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "loadgen.h"
+
+/* Log-linear buckets: one per microsecond below 128, then 64 per power of two */
+#define SUBBUCKETS 64
+#define HISTBUCKETS ((2 + 57) * SUBBUCKETS)
+
+#define RECENTTARGETS 16
+#define MAXRECORDED 65536
+
+typedef struct {
+    char name[32];
+    uint64_t counts[HISTBUCKETS];
+    uint64_t done;
+    uint64_t hung;
+    uint64_t dropped;
+    double sum;                     /* ms */
+    double max;
+} loadclass_t;
+
+typedef struct {
+    int loadClass;
+    int frame;
+    int priority;
+    double deadline;
+} loadrequest_t;
+
+static double rate = 50;
+static int count = 0;
+static int max_frame = 15000;
+static double recent_share = 0.7;
+static int window = 500;
+static int checkpoints = -1;              /* -1 keeps the scheduler's own */
+static uint64_t rng = 1;
+
+static loadclass_t classes[MAXLOADCLASSES];
+static int class_count = 0;
+
+static loadrequest_t* recorded = NULL;
+static int recorded_count = 0;
+
+static int recent[RECENTTARGETS];
+static int recent_count = 0;
+static int recent_pos = 0;
+
+static int pending = 0;
+static double last_done = 0;
+
+/* splitmix64 */
+static uint64_t nextRandom() {
+    uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+static double uniform() {
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int bucketOf(uint64_t us) {
+    if (us < 2 * SUBBUCKETS) { return (int)us; }
+
+    /* us >> shift is in [SUBBUCKETS, 2 * SUBBUCKETS) */
+    int shift = 63 - __builtin_clzll(us) - 6;
+
+    return (shift + 1) * SUBBUCKETS + (int)((us >> shift) - SUBBUCKETS);
+}
+
+/* The highest value that lands in bucket b */
+static uint64_t bucketTop(int b) {
+    if (b < 2 * SUBBUCKETS) { return (uint64_t)b; }
+
+    int shift = b / SUBBUCKETS - 1;
+    uint64_t sub = b % SUBBUCKETS + SUBBUCKETS;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+/* Latency in ms below which a share q of the class's requests finished */
+static double percentile(const loadclass_t* c, double q) {
+    uint64_t target = (uint64_t)ceil(q * c->done);
+    if (target == 0) { target = 1; }
+
+    uint64_t seen = 0;
+
+    for (int b = 0; b < HISTBUCKETS; b++) {
+        seen += c->counts[b];
+        if (seen >= target) { return fmin(bucketTop(b) / 1000.0, c->max); }
+    }
+
+    return c->max;
+}
+
+static int findClass(const char* name, size_t len) {
+    for (int i = 0; i < class_count; i++) {
+        if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0) { return i; }
+    }
+
+    /* The last class takes the overflow */
+    if (class_count == MAXLOADCLASSES) { return MAXLOADCLASSES - 1; }
+
+    if (len >= sizeof(classes[0].name)) { len = sizeof(classes[0].name) - 1; }
+
+    memcpy(classes[class_count].name, name, len);
+    classes[class_count].name[len] = '\0';
+
+    return class_count++;
+}
+
+static int classOf(const char* id) {
+    const char* dash = strchr(id, '-');
+
+    return findClass(id, dash != NULL ? (size_t)(dash - id) : strlen(id));
+}
+
+static void requestDone(const char* id, int frame, double latency, bool hung) {
+    (void)frame;
+
+    loadclass_t* c = &classes[classOf(id)];
+
+    pending--;
+    last_done = scheduleNow();
+
+    if (hung) {
+        c->hung++;
+        return;
+    }
+
+    uint64_t us = latency > 0 ? (uint64_t)(latency * 1000.0) : 0;
+
+    c->counts[bucketOf(us)]++;
+    c->done++;
+    c->sum += latency;
+    if (latency > c->max) { c->max = latency; }
+}
+
+static void parseSpec(const char* spec) {
+    char* copy = strdup(spec);
+    char* save = NULL;
+
+    for (char* item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(item, '=');
+
+        if (value == NULL) {
+            printf("Load setting `%s` has no value. Exiting...\n", item);
+            exit(1);
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(item, "rate") == 0) {
+            rate = strtod(value, NULL);
+        } else if (strcmp(item, "count") == 0) {
+            count = (int)strtol(value, NULL, 0);
+        } else if (strcmp(item, "frames") == 0) {
+            max_frame = (int)strtol(value, NULL, 0);
+        } else if (strcmp(item, "recent") == 0) {
+            recent_share = strtod(value, NULL);
+        } else if (strcmp(item, "window") == 0) {
+            window = (int)strtol(value, NULL, 0);
+        } else if (strcmp(item, "checkpoints") == 0) {
+            checkpoints = (int)strtol(value, NULL, 0);
+        } else if (strcmp(item, "seed") == 0) {
+            rng = strtoull(value, NULL, 0);
+        } else {
+            printf("Unknown load setting `%s`. Exiting...\n", item);
+            exit(1);
+        }
+    }
+
+    free(copy);
+
+    if (rate <= 0 || max_frame < 1 || window < 0 || (checkpoints < 0 && strstr(spec, "checkpoints=") != NULL)) {
+        printf("Bad load settings `%s`. Exiting...\n", spec);
+        exit(1);
+    }
+}
+
+/* Takes the seek lines of a request file, in the format of runSchedule() */
+static void loadRecorded(const char* filename) {
+    FILE* fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+
+    if (fp == NULL) {
+        printf("Couldn't open requests `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    recorded = calloc(MAXRECORDED, sizeof(loadrequest_t));
+
+    char line[256];
+
+    while (recorded_count < MAXRECORDED && fgets(line, sizeof(line), fp) != NULL) {
+        char command[16];
+        char id[64];
+        loadrequest_t* r = &recorded[recorded_count];
+
+        r->priority = 0;
+        r->deadline = 0;
+
+        if (sscanf(line, "%15s %63s %d %d %lf", command, id, &r->frame, &r->priority, &r->deadline) < 3 ||
+            strcmp(command, "seek") != 0 || r->frame < 0) {
+            continue;
+        }
+
+        r->loadClass = classOf(id);
+        recorded_count++;
+    }
+
+    if (fp != stdin) { fclose(fp); }
+
+    if (recorded_count == 0) {
+        printf("No seek requests in `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+}
+
+static loadrequest_t nextRequest(int n) {
+    if (recorded != NULL) { return recorded[n % recorded_count]; }
+
+    static int recentClass = -1;
+    static int randomClass = -1;
+
+    if (recentClass < 0) {
+        recentClass = findClass("recent", 6);
+        randomClass = findClass("random", 6);
+    }
+
+    loadrequest_t r;
+    memset(&r, 0, sizeof(r));
+
+    if (recent_count > 0 && uniform() < recent_share) {
+        /* Newer targets are picked more often, each half as likely as the next */
+        int age = 0;
+        while (age < recent_count - 1 && uniform() < 0.5) { age++; }
+
+        r.loadClass = recentClass;
+        r.frame = recent[(recent_pos - 1 - age + RECENTTARGETS) % RECENTTARGETS] + (int)(uniform() * (window + 1));
+    } else {
+        r.loadClass = randomClass;
+        r.frame = 1 + (int)(uniform() * max_frame);
+    }
+
+    recent[recent_pos] = r.frame;
+    recent_pos = (recent_pos + 1) % RECENTTARGETS;
+    if (recent_count < RECENTTARGETS) { recent_count++; }
+
+    return r;
+}
+
+static void waitUntil(double time) {
+    double wait = time - scheduleNow();
+    if (wait <= 0) { return; }
+
+    struct timespec ts = { (time_t)(wait / 1000), (long)(fmod(wait, 1000) * 1000000) };
+    nanosleep(&ts, NULL);
+}
+
+static void report(double elapsed) {
+    static const double ladder[] = { 0.5, 0.75, 0.9, 0.95, 0.99, 0.995, 0.999, 0.9995, 0.9999 };
+
+    for (int i = 0; i < class_count; i++) {
+        const loadclass_t* c = &classes[i];
+
+        printf("%s: %llu done, %llu hung, %llu dropped, %.1f/s", c->name, (unsigned long long)c->done,
+               (unsigned long long)c->hung, (unsigned long long)c->dropped, elapsed > 0 ? c->done * 1000.0 / elapsed : 0);
+
+        if (c->done > 0) {
+            printf(", latency mean %.2f ms, p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms", c->sum / c->done,
+                   percentile(c, 0.5), percentile(c, 0.99), percentile(c, 0.999), c->max);
+        }
+
+        putchar('\n');
+
+        if (c->done == 0) { continue; }
+
+        for (size_t l = 0; l < sizeof(ladder) / sizeof(ladder[0]); l++) {
+            verbose("    %8.4f%% %10.3f ms\n", ladder[l] * 100, percentile(c, ladder[l]));
+        }
+    }
+}
+
+int runLoad(const schedule_t* base, const char* spec) {
+    parseSpec(spec);
+
+    if (base->requests != NULL) { loadRecorded(base->requests); }
+    if (count == 0) { count = recorded != NULL ? recorded_count : 1000; }
+
+    schedule_t schedule = *base;
+    if (checkpoints >= 0) { schedule.checkpoints = checkpoints; }
+    schedule.done = requestDone;
+
+    printf("Load: %d %s requests at %.1f/s, %d checkpoints, slices of %llu cycles\n", count,
+           recorded != NULL ? "recorded" : "synthetic", rate, schedule.checkpoints, (unsigned long long)schedule.sliceCycles);
+    fflush(stdout);
+
+    scheduleBegin(&schedule);
+
+    double start = scheduleNow();
+    double due = start;
+    int issued = 0;
+    uint64_t dropped = 0;
+
+    while (issued < count || pending > 0) {
+        double time = scheduleNow();
+
+        /* Everything due by now goes in, stamped with when it was due */
+        while (issued < count && due <= time) {
+            loadrequest_t r = nextRequest(issued);
+
+            char id[64];
+            snprintf(id, sizeof(id), "%s-%d", classes[r.loadClass].name, issued);
+
+            if (scheduleSubmit(id, r.frame, r.priority, r.deadline, due)) {
+                pending++;
+            } else {
+                classes[r.loadClass].dropped++;
+                dropped++;
+            }
+
+            issued++;
+            due += -log(1.0 - uniform()) * 1000.0 / rate;
+        }
+
+        if (!scheduleStep() && issued < count) { waitUntil(due); }
+    }
+
+    double elapsed = last_done > start ? last_done - start : 0;
+    uint64_t done = 0;
+    for (int i = 0; i < class_count; i++) { done += classes[i].done; }
+
+    printf("Load: %llu done, %llu dropped in %.2f s, %.1f/s\n", (unsigned long long)done, (unsigned long long)dropped,
+           elapsed / 1000.0, elapsed > 0 ? done * 1000.0 / elapsed : 0);
+
+    report(elapsed);
+    free(recorded);
+
+    return scheduleEnd();
+}
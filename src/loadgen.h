@@ -0,0 +1,38 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include "scheduler.h"
+
+#define MAXLOADCLASSES 16
+
+/*
+ * Load generator for the seek scheduler, driven in-process. Requests arrive
+ * open-loop at a target rate with exponential gaps from a seeded generator,
+ * so runs repeat and a backlog isn't hidden: latency counts from when a
+ * request was due, not from when the scheduler took it. The mix is either
+ * synthetic, seeks to a random frame and seeks just past a recent target,
+ * or the seek lines of a request file replayed in order.
+ *
+ * The spec is a comma separated list of key=value:
+ *
+ *     rate         requests per second, 50
+ *     count        requests in total, 1000 or the file's seek lines
+ *     frames       highest random frame, 15000
+ *     recent       share of seeks near a recent target, 0.7
+ *     window       frames past the target they land within, 500
+ *     checkpoints  finished machines the scheduler keeps, --checkpoints
+ *     seed         1
+ *
+ * A request's class is its id up to the first `-`, `recent` or `random` in
+ * the synthetic mix. Every class has a log-linear latency histogram, exact
+ * to the microsecond up to 128 us and within 1/64 above, reported as
+ * throughput and percentiles.
+ *
+ * All requests seek in the one tune given on the command line, so the mix
+ * has no tune or subtune of its own, and requests are handed over by call
+ * rather than through a local socket. Latencies leave out the cost of a
+ * transport.
+ */
+int runLoad(const schedule_t* schedule, const char* spec);
+
+#endif
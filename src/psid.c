@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "psid.h"
+
+#define PSID_V1_HEADER 0x76
+#define PSID_V2_HEADER 0x7c
+
+static uint16_t be16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void copyString(char* dest, const uint8_t* src) {
+    memcpy(dest, src, 32);
+    dest[32] = '\0';
+}
+
+int psidParse(const uint8_t* file, size_t size, psid_t* psid) {
+    memset(psid, 0, sizeof(*psid));
+
+    if (size < PSID_V1_HEADER) { return PSID_BADHEADER; }
+
+    if (memcmp(file, "PSID", 4) == 0) {
+        psid->rsid = false;
+    } else if (memcmp(file, "RSID", 4) == 0) {
+        psid->rsid = true;
+    } else {
+        return PSID_BADHEADER;
+    }
+
+    psid->version = be16(file + 0x04);
+    psid->dataOffset = be16(file + 0x06);
+    psid->loadAddress = be16(file + 0x08);
+    psid->initAddress = be16(file + 0x0a);
+    psid->playAddress = be16(file + 0x0c);
+    psid->songs = be16(file + 0x0e);
+    psid->startSong = be16(file + 0x10);
+    psid->speed = ((uint32_t)be16(file + 0x12) << 16) | be16(file + 0x14);
+
+    if (psid->version >= 2 && size >= PSID_V2_HEADER) { psid->flags = be16(file + 0x76); }
+
+    copyString(psid->name, file + 0x16);
+    copyString(psid->author, file + 0x36);
+    copyString(psid->released, file + 0x56);
+
+    if (psid->dataOffset < PSID_V1_HEADER || psid->dataOffset >= size) { return PSID_BADHEADER; }
+    if (psid->songs == 0) { psid->songs = 1; }
+
+    psid->data = file + psid->dataOffset;
+    psid->dataSize = size - psid->dataOffset;
+
+    if (psid->loadAddress == 0) {
+        if (psid->dataSize < 2) { return PSID_BADHEADER; }
+
+        psid->loadAddress = (uint16_t)(psid->data[0] | (psid->data[1] << 8));
+        psid->data += 2;
+        psid->dataSize -= 2;
+    }
+
+    if (psid->initAddress == 0) { psid->initAddress = psid->loadAddress; }
+
+    /* RSIDs and tunes installing their own IRQ need CIA/VIC emulation */
+    if (psid->rsid || psid->playAddress == 0) { return PSID_UNSUPPORTED; }
+
+    return PSID_OK;
+}
+
+static bool pageFree(const psid_t* psid, int page) {
+    uint32_t start = page << 8;
+    uint32_t end = start + 256;
+
+    return end <= psid->loadAddress || start >= psid->loadAddress + psid->dataSize;
+}
+
+static int findDriverPage(const psid_t* psid) {
+    for (int page = 0xcf; page >= 0x04; page--) {
+        if (pageFree(psid, page)) { return page; }
+    }
+
+    for (int page = 0xfe; page >= 0xe0; page--) {
+        if (pageFree(psid, page)) { return page; }
+    }
+
+    return -1;
+}
+
+/* Loads the tune into memory and installs a driver doing what player.asm
+   does, with the frame counter and flip-flop kept inside the driver page */
+int psidInstall(const psid_t* psid, int subtune, driver_t* driver) {
+    if (psid->loadAddress + psid->dataSize > MEMSIZE) { return PSID_TOOBIG; }
+
+    int page = findDriverPage(psid);
+    if (page < 0) { return PSID_NOROOM; }
+
+    memcpy(memory + psid->loadAddress, psid->data, psid->dataSize);
+
+    uint16_t base = (uint16_t)(page << 8);
+
+    driver->page = (uint8_t)page;
+    driver->start = base;
+    driver->frameCounter = base + 0xf0;
+    driver->flipflop = base + 0xf4;
+
+    uint8_t cl = 0xf0, ch = (uint8_t)page;
+    uint8_t il = psid->initAddress & 255, ih = psid->initAddress >> 8;
+    uint8_t pl = psid->playAddress & 255, ph = psid->playAddress >> 8;
+
+    const uint8_t code[] = {
+        0xa9, 0x00,                     /* lda #0            */
+        0x8d, cl + 0, ch,               /* sta counter       */
+        0x8d, cl + 1, ch,               /* sta counter + 1   */
+        0x8d, cl + 2, ch,               /* sta counter + 2   */
+        0x8d, cl + 3, ch,               /* sta counter + 3   */
+        0x8d, cl + 4, ch,               /* sta flipflop      */
+        0xa9, (uint8_t)(subtune - 1),   /* lda #subtune      */
+        0x20, il, ih,                   /* jsr init          */
+        0x20, pl, ph,                   /* loop: jsr play    */
+        0x18,                           /* clc               */
+        0xa9, 0x01,                     /* lda #1            */
+        0x6d, cl + 0, ch,               /* adc counter       */
+        0x8d, cl + 0, ch,               /* sta counter       */
+        0xad, cl + 1, ch,               /* lda counter + 1   */
+        0x69, 0x00,                     /* adc #0            */
+        0x8d, cl + 1, ch,               /* sta counter + 1   */
+        0xad, cl + 2, ch,               /* lda counter + 2   */
+        0x69, 0x00,                     /* adc #0            */
+        0x8d, cl + 2, ch,               /* sta counter + 2   */
+        0xad, cl + 3, ch,               /* lda counter + 3   */
+        0x69, 0x00,                     /* adc #0            */
+        0x8d, cl + 3, ch,               /* sta counter + 3   */
+        0xad, cl + 4, ch,               /* lda flipflop      */
+        0x49, 0xff,                     /* eor #$ff          */
+        0x8d, cl + 4, ch,               /* sta flipflop      */
+        0x4c, 0x16, ch,                 /* jmp loop          */
+    };
+
+    memcpy(memory + base, code, sizeof(code));
+
+    return PSID_OK;
+}
+
+/* Points an installed driver at another subtune */
+void psidSubtune(const driver_t* driver, int subtune) {
+    memory[driver->start + PSIDSUBTUNE] = (uint8_t)(subtune - 1);
+    touchMemory(driver->start + PSIDSUBTUNE, driver->start + PSIDSUBTUNE);
+}
+
+const char* psidError(int status) {
+    switch (status) {
+        case PSID_OK: return "ok";
+        case PSID_BADHEADER: return "bad header";
+        case PSID_UNSUPPORTED: return "unsupported (RSID or IRQ player)";
+        case PSID_TOOBIG: return "doesn't fit in memory";
+        case PSID_NOROOM: return "no free page for driver";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,50 @@
+#ifndef PSID_H
+#define PSID_H
+
+#include "sidulator.h"
+
+#include <stddef.h>
+
+enum {
+    PSID_OK,
+    PSID_BADHEADER,
+    PSID_UNSUPPORTED,
+    PSID_TOOBIG,
+    PSID_NOROOM
+};
+
+typedef struct {
+    bool rsid;
+    uint16_t version;
+    uint16_t dataOffset;
+    uint16_t loadAddress;
+    uint16_t initAddress;
+    uint16_t playAddress;
+    uint16_t songs;
+    uint16_t startSong;
+    uint32_t speed;
+    uint16_t flags;             /* v2+: clock and SID model */
+    char name[33];
+    char author[33];
+    char released[33];
+    const uint8_t* data;        /* C64 data, load address already stripped */
+    size_t dataSize;
+} psid_t;
+
+/* Offset of the `lda #subtune` operand in the driver */
+#define PSIDSUBTUNE 18
+
+/* Built-in replacement for player.prg, generated per tune and subtune */
+typedef struct {
+    uint16_t start;
+    uint16_t frameCounter;      /* 32-bit little-endian frame counter */
+    uint16_t flipflop;          /* toggled after every play call */
+    uint8_t page;               /* page holding the driver, ignored in diffs */
+} driver_t;
+
+int psidParse(const uint8_t* file, size_t size, psid_t* psid);
+int psidInstall(const psid_t* psid, int subtune, driver_t* driver);
+void psidSubtune(const driver_t* driver, int subtune);
+const char* psidError(int status);
+
+#endif
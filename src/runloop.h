@@ -0,0 +1,63 @@
+/*
+ * Interpreter loop template, included once per variant by sidulator.c with
+ * RUNLOOP_NAME and RUNLOOP_FEATURES (a constant RUN_* mask) defined. The
+ * feature tests fold away at compile time, so a variant only carries the
+ * per-instruction work it was built for. No include guard on purpose.
+ *
+ * Runs until the frame flip-flop toggles or the instruction budget is
+ * spent, and returns the budget left. RUN_LOOPS runs counted loops in
+ * closed form, never past the budget.
+ */
+
+static long long RUNLOOP_NAME(long long budget) {
+    while (!frame_done && budget > 0) {
+#if (RUNLOOP_FEATURES) & RUN_LOOPS
+        if (loop_entry[memory[pc]] && !loop_none[pc]) {
+            int counted = fastLoop(budget);
+
+            if (counted > 0) {
+                budget -= counted;
+                continue;
+            }
+        }
+#endif
+        budget--;
+
+#if (RUNLOOP_FEATURES) & RUN_TRACE
+        traceInstruction();
+#endif
+#if (RUNLOOP_FEATURES) & RUN_PROFILE
+        ushort at = pc;
+#endif
+
+        opcode = read6502(pc++);
+        status |= FLAG_CONSTANT;
+
+        penaltyop = 0;
+        penaltyaddr = 0;
+        clockticks6502 = 0;
+
+        (*addrtable[opcode])();
+        (*optable[opcode])();
+
+        clockticks6502 += ticktable[opcode];
+        if (penaltyop && penaltyaddr) { clockticks6502++; }
+
+        instructions++;
+        play_stats.instructions++;
+        play_stats.frameCycles += clockticks6502;
+
+#if (RUNLOOP_FEATURES) & RUN_PROFILE
+        profile_cycles[at] += clockticks6502;
+        profile_opcodes[opcode]++;
+#endif
+#if (RUNLOOP_FEATURES) & RUN_HOOKS
+        (*loopexternal)();
+#endif
+    }
+
+    return budget;
+}
+
+#undef RUNLOOP_NAME
+#undef RUNLOOP_FEATURES
@@ -0,0 +1,397 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "scheduler.h"
+#include "hash.h"
+
+#define MAXREQUEST 256
+
+typedef struct {
+    char id[64];
+    int frame;                      /* target */
+    int reached;
+    int priority;                   /* higher runs first */
+    double submitted;               /* ms */
+    double deadline;                /* ms, DBL_MAX for none */
+    double cyclesPerFrame;
+    uint64_t lastRun;               /* slice number, 0 before the first */
+    context_t* context;             /* allocated when first suspended */
+} scheduledjob_t;
+
+/* A finished machine kept for later seeks, evicted least recently used */
+typedef struct {
+    context_t context;
+    int frame;
+    uint64_t lastUsed;              /* slice number */
+} checkpoint_t;
+
+static const schedule_t* schedule = NULL;
+
+static scheduledjob_t* jobs[MAXSCHEDULEDJOBS];
+static int job_count = 0;
+static scheduledjob_t* running = NULL;     /* the job whose machine is loaded */
+static uint64_t slices = 0;
+
+static double* latencies = NULL;
+static int latency_count = 0;
+static int latency_size = 0;
+static int cancelled_count = 0;
+static int hung_count = 0;
+static int late_count = 0;
+
+static checkpoint_t* checkpoints = NULL;
+static int checkpoint_count = 0;
+static uint64_t checkpoint_hits = 0;
+
+double scheduleNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int findJob(const char* id) {
+    for (int i = 0; i < job_count; i++) {
+        if (strcmp(jobs[i]->id, id) == 0) { return i; }
+    }
+
+    return -1;
+}
+
+static void removeJob(int index) {
+    scheduledjob_t* job = jobs[index];
+
+    if (running == job) { running = NULL; }
+
+    free(job->context);
+    free(job);
+
+    jobs[index] = jobs[--job_count];
+}
+
+static void request(char* line) {
+    char command[16];
+    char id[64];
+    int frame = 0;
+    int priority = 0;
+    double deadline = 0;
+
+    int fields = sscanf(line, "%15s %63s %d %d %lf", command, id, &frame, &priority, &deadline);
+
+    if (fields >= 2 && strcmp(command, "cancel") == 0) {
+        int index = findJob(id);
+
+        if (index >= 0) {
+            removeJob(index);
+            cancelled_count++;
+            printf("cancelled %s\n", id);
+        }
+
+        return;
+    }
+
+    if (fields < 3 || strcmp(command, "seek") != 0 || frame < 0) {
+        printf("bad request `%s`\n", line);
+        return;
+    }
+
+    if (!scheduleSubmit(id, frame, priority, deadline, scheduleNow())) { printf("busy %s\n", id); }
+}
+
+bool scheduleSubmit(const char* id, int frame, int priority, double deadline, double submitted) {
+    if (job_count >= MAXSCHEDULEDJOBS || findJob(id) >= 0) { return false; }
+
+    scheduledjob_t* job = calloc(1, sizeof(scheduledjob_t));
+    snprintf(job->id, sizeof(job->id), "%s", id);
+    job->frame = frame;
+    job->priority = priority;
+    job->submitted = submitted;
+    job->deadline = deadline > 0 ? submitted + deadline : DBL_MAX;
+
+    jobs[job_count++] = job;
+
+    return true;
+}
+
+/* Takes the complete lines waiting on fd, returns false at end of input */
+static bool readRequests(int fd) {
+    static char buffer[MAXREQUEST * 16];
+    static size_t used = 0;
+
+    ssize_t got = read(fd, buffer + used, sizeof(buffer) - used - 1);
+
+    if (got <= 0) {
+        if (used > 0) {
+            buffer[used] = '\0';
+            request(buffer);
+            used = 0;
+        }
+
+        return false;
+    }
+
+    used += got;
+
+    char* line = buffer;
+    char* end = NULL;
+
+    while ((end = memchr(line, '\n', buffer + used - line)) != NULL) {
+        *end = '\0';
+        if (end > line) { request(line); }
+        line = end + 1;
+    }
+
+    used -= line - buffer;
+    memmove(buffer, line, used);
+
+    /* A line longer than the buffer is dropped */
+    if (used == sizeof(buffer) - 1) { used = 0; }
+
+    return true;
+}
+
+static bool before(const scheduledjob_t* l, const scheduledjob_t* r) {
+    if (l->priority != r->priority) { return l->priority > r->priority; }
+    if (l->deadline != r->deadline) { return l->deadline < r->deadline; }
+
+    return l->lastRun < r->lastRun;
+}
+
+static int pickJob() {
+    int best = -1;
+
+    for (int i = 0; i < job_count; i++) {
+        if (best < 0 || before(jobs[i], jobs[best])) { best = i; }
+    }
+
+    return best;
+}
+
+/* The latest checkpoint at or before frame, NULL if none */
+static checkpoint_t* findCheckpoint(int frame) {
+    checkpoint_t* best = NULL;
+
+    for (int i = 0; i < checkpoint_count; i++) {
+        if (checkpoints[i].frame <= frame && (best == NULL || checkpoints[i].frame > best->frame)) { best = &checkpoints[i]; }
+    }
+
+    return best;
+}
+
+static void keepCheckpoint(int frame) {
+    checkpoint_t* slot = NULL;
+
+    for (int i = 0; i < checkpoint_count; i++) {
+        if (checkpoints[i].frame == frame) {
+            checkpoints[i].lastUsed = slices;
+            return;
+        }
+
+        if (slot == NULL || checkpoints[i].lastUsed < slot->lastUsed) { slot = &checkpoints[i]; }
+    }
+
+    if (checkpoint_count < schedule->checkpoints) { slot = &checkpoints[checkpoint_count++]; }
+
+    slot->context.saved = false;
+    contextSave(&slot->context);
+    slot->frame = frame;
+    slot->lastUsed = slices;
+}
+
+static void switchTo(scheduledjob_t* job) {
+    if (running == job) { return; }
+
+    if (running != NULL) {
+        if (running->context == NULL) { running->context = calloc(1, sizeof(context_t)); }
+        contextSave(running->context);
+    }
+
+    checkpoint_t* checkpoint = NULL;
+
+    if (job->context != NULL && job->context->saved) {
+        contextLoad(job->context);
+    } else if ((checkpoint = findCheckpoint(job->frame)) != NULL) {
+        contextLoad(&checkpoint->context);
+        checkpoint->lastUsed = slices;
+        checkpoint_hits++;
+
+        job->reached = checkpoint->frame;
+        if (job->reached > 0) { job->cyclesPerFrame = (double)play_stats.cycles / job->reached; }
+    } else {
+        touchMemory(0, MEMSIZE - 1);
+        templateReset(schedule->tune);
+        startMusic(schedule->tune->start);
+    }
+
+    running = job;
+}
+
+static void saveDiff(const scheduledjob_t* job) {
+    const char* name = schedule->diffFilename;
+    const char* ext = strrchr(name, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL) { ext = name + strlen(name); }
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%.*s_%s%s", (int)(ext - name), name, job->id, ext);
+
+    FILE* fp = NULL;
+
+    if (!schedule->overwrite && (fp = fopen(filename, "rb")) != NULL) {
+        printf("Diff file `%s` already exists, not written\n", filename);
+        fclose(fp);
+        return;
+    }
+
+    if ((fp = createFile(filename, "wb")) == NULL) {
+        printf("Couldn't create diff file `%s`\n", filename);
+        return;
+    }
+
+    filterChanges(schedule->includeRegions);
+    writeDiff(fp, memory, memory_changes);
+    fclose(fp);
+}
+
+static void finish(int index) {
+    scheduledjob_t* job = jobs[index];
+    double latency = scheduleNow() - job->submitted;
+    bool late = scheduleNow() > job->deadline;
+
+    /* Before the diff filter touches the change map */
+    if (schedule->checkpoints > 0) { keepCheckpoint(job->reached); }
+    if (schedule->diffFilename != NULL) { saveDiff(job); }
+
+    if (schedule->done != NULL) {
+        schedule->done(job->id, job->reached, latency, false);
+    } else {
+        printf("done %s %d %016llx %.2f%s\n", job->id, job->reached,
+               (unsigned long long)hash64(memory, MEMSIZE, HASH_INIT), latency, late ? " late" : "");
+    }
+
+    if (late) { late_count++; }
+
+    if (latency_count == latency_size) {
+        latency_size = latency_size ? latency_size * 2 : 1024;
+        latencies = realloc(latencies, latency_size * sizeof(double));
+    }
+
+    latencies[latency_count++] = latency;
+
+    /* The diff filter changed the machine, it can't be resumed */
+    running = NULL;
+    removeJob(index);
+}
+
+/* Plays whole frames up to about sliceCycles, returns the frame reached or -1 if hung */
+static int runSlice(scheduledjob_t* job) {
+    int frames = job->cyclesPerFrame > 0 ? (int)(schedule->sliceCycles / job->cyclesPerFrame) : 1;
+    if (frames < 1) { frames = 1; }
+
+    int target = job->frame - job->reached > frames ? job->reached + frames : job->frame;
+    int reached = playMusic(schedule->frameCounter, schedule->flipflop, target);
+
+    job->lastRun = ++slices;
+
+    if (reached > 0) {
+        job->reached = reached;
+        job->cyclesPerFrame = (double)play_stats.cycles / reached;
+    }
+
+    return reached;
+}
+
+static int byLatency(const void* l, const void* r) {
+    double a = *(const double*)l;
+    double b = *(const double*)r;
+
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+void scheduleBegin(const schedule_t* s) {
+    schedule = s;
+
+    if (s->checkpoints > 0) { checkpoints = calloc(s->checkpoints, sizeof(checkpoint_t)); }
+}
+
+bool scheduleStep() {
+    int index = pickJob();
+    if (index < 0) { return false; }
+
+    switchTo(jobs[index]);
+
+    scheduledjob_t* job = jobs[index];
+    int reached = runSlice(job);
+
+    if (reached < 0) {
+        if (schedule->done != NULL) {
+            schedule->done(job->id, job->reached, scheduleNow() - job->submitted, true);
+        } else {
+            printf("hung %s %d\n", job->id, job->reached);
+        }
+
+        hung_count++;
+        removeJob(index);
+    } else if (reached >= job->frame) {
+        finish(index);
+    }
+
+    return true;
+}
+
+int scheduleEnd() {
+    qsort(latencies, latency_count, sizeof(double), byLatency);
+
+    printf("Schedule: %d done, %d cancelled, %d hung, %d late, %llu slices",
+           latency_count, cancelled_count, hung_count, late_count, (unsigned long long)slices);
+
+    if (latency_count > 0) {
+        printf(", latency p50 %.2f ms, p99 %.2f ms, max %.2f ms", latencies[latency_count / 2],
+               latencies[(latency_count * 99) / 100], latencies[latency_count - 1]);
+    }
+
+    if (schedule->checkpoints > 0) {
+        printf(", %llu seeks from %d checkpoints", (unsigned long long)checkpoint_hits, checkpoint_count);
+    }
+
+    putchar('\n');
+    free(latencies);
+    free(checkpoints);
+
+    return hung_count > 0 ? 1 : 0;
+}
+
+int runSchedule(const schedule_t* s) {
+    scheduleBegin(s);
+
+    int fd = strcmp(s->requests, "-") == 0 ? 0 : open(s->requests, O_RDONLY);
+
+    if (fd < 0) {
+        printf("Couldn't open requests `%s`. Exiting...\n", s->requests);
+        exit(1);
+    }
+
+    bool reading = true;
+
+    while (reading || job_count > 0) {
+        if (reading) {
+            /* Only wait for requests when there's nothing to run */
+            struct pollfd p = { fd, POLLIN, 0 };
+
+            if (poll(&p, 1, job_count > 0 ? 0 : -1) > 0) { reading = readRequests(fd); }
+        }
+
+        if (scheduleStep()) { fflush(stdout); }
+    }
+
+    if (fd != 0) { close(fd); }
+
+    return scheduleEnd();
+}
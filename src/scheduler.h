@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "sidulator.h"
+
+#define MAXSCHEDULEDJOBS 256
+#define SLICECYCLES 1000000
+
+/*
+ * Serves many seeks of one tune on a single core. Requests come in one per
+ * line, from a file or a pipe that's polled between slices:
+ *
+ *     seek <id> <frame> [<priority> [<deadline ms>]]
+ *     cancel <id>
+ *
+ * Every job starts from the tune template and runs in slices of about
+ * sliceCycles emulated cycles, rounded to whole frames. Between slices the
+ * machine of a job is kept in its own context_t. The next slice goes to the
+ * highest priority, then the earliest deadline, then the job that waited
+ * longest. Results go to stdout as they finish:
+ *
+ *     done <id> <frame> <fingerprint> <latency ms> [late]
+ *     hung <id> <frame>
+ *     cancelled <id>
+ *
+ * With checkpoints (--checkpoints), the machines of that many finished jobs
+ * are kept, and a new job starts from the latest one at or before its frame
+ * instead of the template. The least recently used one makes room.
+ *
+ * The same scheduler is driven in-process by scheduleSubmit() and
+ * scheduleStep(), see loadgen.h. A done callback then replaces the result
+ * lines, latencies are measured from the given submission time.
+ */
+typedef struct {
+    const char* requests;           /* a file, or `-` for stdin */
+    const char* diffFilename;       /* `<name>_<id><ext>` per job when set */
+    const char* includeRegions;
+    bool overwrite;
+    const template_t* tune;
+    uint16_t frameCounter;
+    uint16_t flipflop;
+    uint64_t sliceCycles;
+    int checkpoints;                /* finished machines kept, 0 for none */
+    void (*done)(const char* id, int frame, double latency, bool hung);
+} schedule_t;
+
+int runSchedule(const schedule_t* schedule);
+
+void scheduleBegin(const schedule_t* schedule);
+bool scheduleSubmit(const char* id, int frame, int priority, double deadline, double submitted);   /* false when busy */
+bool scheduleStep();                                    /* one slice, false when nothing is waiting */
+int scheduleEnd();                                      /* prints the summary */
+double scheduleNow();                                   /* ms, the clock latencies are measured on */
+
+#endif
@@ -5,30 +5,395 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <unistd.h>
+#include <time.h>
 
 #define FAKE6502_USE_STDINT
+/* N, Z, C and V are computed on demand, build with -DFAKE6502_EAGER_FLAGS for the stock core */
+#ifndef FAKE6502_EAGER_FLAGS
+#define FAKE6502_LAZY_FLAGS
+#endif
 #include "../3rdparty/fake6502/fake6502.h"
 
+#include "sidulator.h"
+#include "watch.h"
+#include "corpus.h"
+#include "store.h"
+#include "hash.h"
+#include "export.h"
+#include "delta.h"
+#include "telemetry.h"
+#include "events.h"
+#include "find.h"
+#include "scheduler.h"
+#include "loadgen.h"
+#include "audio.h"
+
 #define VERSION "0.1.0"
 
-#define MAXFRAMES 100000000
+#define MAXDELTAS 64
+
+/* Frames played past the position to see what the play routine accesses */
+#define OBSERVEFRAMES 50
 
-#define MEMSIZE 65536
-static uint8 memory[MEMSIZE];
-static uint8 memory_changes[MEMSIZE];
+uint8 memory[MEMSIZE];
+uint8 memory_changes[MEMSIZE];
+
+playstats_t play_stats;
+uint64_t* cycle_meter = NULL;
+watchdog_t watchdog = { RASTERCYCLES, HANGCYCLES, INITCYCLES };
+static int current_frame = 0;
 
 uint8 read6502(ushort addr) {
     return memory[addr];
 }
 
+/* Per-address write traps, so frame ends and watches need no polling */
+#define TRAP_FRAME 1
+#define TRAP_WATCH 2
+#define TRAP_JOURNAL 4
+#define TRAP_MEMO 8
+#define TRAP_EVENTS 16
+#define TRAP_FIND 32
+
+static uint8 write_trap[MEMSIZE];
+
+/* Writes are marked here; points to a scratch page when tracking is off */
+static uint8 change_sink[MEMSIZE];
+static uint8* change_map = memory_changes;
+
+/* Pages whose memory or change flags may differ from the last template */
+static uint8 page_dirty[MEMSIZE / 256];
+
+static uint8 frame_flipflop = 0;
+static bool frame_done = false;
+
+static bool journal_enabled = false;
+static void journalWrite(ushort addr);
+static void journalMark(int frame);
+
+static bool memo_enabled = false;
+static bool memo_recording = false;
+static void memoWrite(ushort addr);
+static bool memoReplay();
+static void memoStart();
+static void memoFinish();
+static void memoCount(bool hit);
+
+/* Takes the whole write, so the journal sees the old value */
+static void writeTrap(ushort addr, uint8 val) {
+    if (write_trap[addr] & TRAP_FIND) { findWrite(addr, val); }
+    if (write_trap[addr] & TRAP_JOURNAL) { journalWrite(addr); }
+    if (write_trap[addr] & TRAP_MEMO) { memoWrite(addr); }
+
+    change_map[addr] = 1;
+    memory[addr] = val;
+    page_dirty[addr >> 8] = 1;
+
+    if ((write_trap[addr] & TRAP_EVENTS) && events_enabled) {
+        eventsPush(EVENT_WRITE, play_stats.cycles + play_stats.frameCycles, 0, addr & 0x1f, val);
+    }
+
+    if ((write_trap[addr] & TRAP_FRAME) && val != frame_flipflop) {
+        frame_flipflop = val;
+        frame_done = true;
+    }
+
+    if (write_trap[addr] & TRAP_WATCH) { watchWrite(addr); }
+}
+
 void write6502(ushort addr, uint8 val) {
-    memory_changes[addr] = 1;
+    if (write_trap[addr]) {
+        writeTrap(addr, val);
+        return;
+    }
+
+    change_map[addr] = 1;
     memory[addr] = val;
+    page_dirty[addr >> 8] = 1;
+}
+
+void trackChanges(bool enabled) {
+    change_map = enabled ? memory_changes : change_sink;
+}
+
+bool trackingChanges() {
+    return change_map == memory_changes;
 }
 
 static int flag_verbose = 0;
 static int flag_overwrite = 0;
+static int flag_audiofloat = 0;
 static int flag_ignoresidregs = 0;
+static int flag_watchstop = 0;
+static int flag_corpusdiffs = 0;
+static int flag_profile = 0;
+static int flag_liveness = 0;
+static int flag_baseline = 0;
+static int flag_memo = 0;
+static int flag_fastloops = 0;
+
+static FILE* trace_file = NULL;
+
+static uint64_t profile_cycles[MEMSIZE];
+static uint64_t profile_opcodes[256];
+
+static void traceInstruction() {
+    fprintf(trace_file, "%llu %04x %02x %02x %02x %02x %02x %02x\n",
+            (unsigned long long)(play_stats.cycles + play_stats.frameCycles), pc, memory[pc], a, x, y, sp, getstatus6502());
+}
+
+/* Counted loops run in closed form by -X/--fastloops: up to MAXLOOPOPS
+   LDA/STA indexed by the counter, INX/DEX/INY/DEY, an optional CPX/CPY
+   #imm, and BNE or BPL back to the first instruction. Found at their
+   entry PC, they're checked for I/O, self-modification and trapped
+   addresses before anything is done, then their loads and stores run in
+   order through read6502()/write6502() without dispatch. */
+#define MAXLOOPOPS 8
+
+typedef struct {
+    uint8 op;
+    ushort base;                /* absolute base, or the zero page pointer of (zp),Y */
+} loopop_t;
+
+static uint64_t fastloop_runs = 0;
+static uint64_t fastloop_instructions = 0;
+
+/* PCs whose code isn't a loop shape, so they're parsed once per startMusic().
+   Code rewritten into a loop later only misses the shortcut. */
+static uint8 loop_none[MEMSIZE];
+
+/* Color RAM at $d800-$dbff is plain memory here, the chips around it aren't */
+static inline bool isIO(ushort addr) {
+    return addr >= 0xd000 && addr < 0xe000 && (addr < 0xd800 || addr >= 0xdc00);
+}
+
+static inline bool indexedByY(uint8 op) {
+    return op == 0xb9 || op == 0x99 || op == 0xb1 || op == 0x91;
+}
+
+static inline ushort loopAddress(const loopop_t* o, uint8 index) {
+    if (o->op == 0xb1 || o->op == 0x91) {
+        ushort pointer = memory[o->base] | (memory[(o->base + 1) & 0xff] << 8);
+        return (ushort)(pointer + index);
+    }
+
+    return (ushort)(o->base + index);
+}
+
+/* Returns the instructions the loop at pc stood for, or 0 if it isn't one or can't be */
+static int fastLoop(long long budget) {
+    loopop_t ops[MAXLOOPOPS];
+    int count = 0;
+    ushort at = pc;
+    int useY = -1;
+
+    for (; count < MAXLOOPOPS; count++) {
+        uint8 op = memory[at];
+
+        if (op == 0xbd || op == 0x9d || op == 0xb9 || op == 0x99) {
+            ops[count].base = memory[(ushort)(at + 1)] | (memory[(ushort)(at + 2)] << 8);
+            at += 3;
+        } else if (op == 0xb1 || op == 0x91) {
+            ops[count].base = memory[(ushort)(at + 1)];
+            at += 2;
+        } else {
+            break;
+        }
+
+        if (useY >= 0 && useY != indexedByY(op)) { loop_none[pc] = 1; return 0; }
+
+        useY = indexedByY(op);
+        ops[count].op = op;
+    }
+
+    uint8 counter = memory[at];
+    int step = 0;
+
+    if (counter == 0xe8 || counter == 0xc8) { step = 1; }
+    if (counter == 0xca || counter == 0x88) { step = -1; }
+    if (step == 0 || (useY >= 0 && useY != (counter == 0xc8 || counter == 0x88))) { loop_none[pc] = 1; return 0; }
+
+    useY = counter == 0xc8 || counter == 0x88;
+    at++;
+
+    ushort compareAt = 0;
+
+    if (memory[at] == (useY ? 0xc0 : 0xe0)) {
+        compareAt = at;
+        at += 2;
+    }
+
+    uint8 branch = memory[at];
+    ushort after = (ushort)(at + 2);
+
+    if ((branch != 0xd0 && !(branch == 0x10 && compareAt == 0)) ||
+        (ushort)(after + (int8_t)memory[(ushort)(at + 1)]) != pc) {
+        loop_none[pc] = 1;
+        return 0;
+    }
+
+    uint8 start = useY ? y : x;
+    int n = 0;
+
+    if (branch == 0x10) {
+        /* Runs until the counter turns negative */
+        if (start & 0x80) { return 0; }
+        n = step > 0 ? 0x80 - start : start + 1;
+    } else {
+        uint8 end = compareAt ? memory[(ushort)(compareAt + 1)] : 0;
+        n = (uint8)(step > 0 ? end - start : start - end);
+        if (n == 0) { n = 256; }
+    }
+
+    int perIteration = count + 2 + (compareAt ? 1 : 0);
+    if ((long long)n * perIteration > budget) { return 0; }
+
+    /* Nothing is done until every access is known to be safe */
+    uint64_t cycles = 0;
+    ushort codeEnd = after;
+
+    for (int i = 0; i < n; i++) {
+        uint8 index = (uint8)(start + i * step);
+
+        for (int k = 0; k < count; k++) {
+            const loopop_t* o = &ops[k];
+            ushort addr = loopAddress(o, index);
+
+            if (isIO(addr)) { return 0; }
+
+            cycles += ticktable[o->op];
+
+            if (o->op == 0x9d || o->op == 0x99 || o->op == 0x91) {
+                bool code = codeEnd > pc ? addr >= pc && addr < codeEnd : addr >= pc || addr < codeEnd;
+
+                if (code || (write_trap[addr] & (TRAP_FRAME | TRAP_WATCH | TRAP_EVENTS))) { return 0; }
+
+                for (int j = 0; j < count; j++) {
+                    bool indirect = ops[j].op == 0xb1 || ops[j].op == 0x91;
+                    if (indirect && (addr == ops[j].base || addr == ((ops[j].base + 1) & 0xff))) { return 0; }
+                }
+            } else if ((addr & 0xff00) != ((ushort)(addr - index) & 0xff00)) {
+                cycles++;
+            }
+        }
+    }
+
+    /* The counter step, the compare and the branch, taken but the last time */
+    bool crosses = (after & 0xff00) != (pc & 0xff00);
+
+    cycles += (uint64_t)n * (ticktable[counter] + (compareAt ? ticktable[memory[compareAt]] : 0) + ticktable[branch]);
+    cycles += (uint64_t)(n - 1) * (crosses ? 2 : 1);
+
+    for (int i = 0; i < n; i++) {
+        uint8 index = (uint8)(start + i * step);
+
+        for (int k = 0; k < count; k++) {
+            const loopop_t* o = &ops[k];
+
+            if (o->op == 0xbd || o->op == 0xb9 || o->op == 0xb1) {
+                a = read6502(loopAddress(o, index));
+            } else {
+                write6502(loopAddress(o, index), a);
+            }
+        }
+    }
+
+    uint8 final = (uint8)(start + n * step);
+
+    if (useY) { y = final; } else { x = final; }
+
+    /* The flags the last counter step or compare left */
+    if (compareAt) {
+        opcode = memory[compareAt];
+        ea = (ushort)(compareAt + 1);
+        if (useY) { cpy(); } else { cpx(); }
+    } else {
+        zerocalc(final);
+        signcalc(final);
+    }
+
+    pc = after;
+
+    int instructions6502 = n * perIteration;
+
+    instructions += instructions6502;
+    play_stats.instructions += instructions6502;
+    play_stats.frameCycles += (uint32_t)cycles;
+
+    fastloop_runs++;
+    fastloop_instructions += instructions6502;
+
+    return instructions6502;
+}
+
+/* Opcodes a counted loop can start with */
+static const bool loop_entry[256] = {
+    [0xbd] = true, [0x9d] = true, [0xb9] = true, [0x99] = true, [0xb1] = true, [0x91] = true,
+    [0xe8] = true, [0xca] = true, [0xc8] = true, [0x88] = true
+};
+
+/* Interpreter variants, one per combination of per-instruction features */
+#define RUN_HOOKS   1
+#define RUN_TRACE   2
+#define RUN_PROFILE 4
+#define RUN_LOOPS   8
+
+typedef long long (*runloop_t)(long long budget);
+
+#define RUNLOOP_NAME runLoop
+#define RUNLOOP_FEATURES 0
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopHooks
+#define RUNLOOP_FEATURES RUN_HOOKS
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopTrace
+#define RUNLOOP_FEATURES RUN_TRACE
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopHooksTrace
+#define RUNLOOP_FEATURES (RUN_HOOKS | RUN_TRACE)
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopProfile
+#define RUNLOOP_FEATURES RUN_PROFILE
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopHooksProfile
+#define RUNLOOP_FEATURES (RUN_HOOKS | RUN_PROFILE)
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopTraceProfile
+#define RUNLOOP_FEATURES (RUN_TRACE | RUN_PROFILE)
+#include "runloop.h"
+
+#define RUNLOOP_NAME runLoopAll
+#define RUNLOOP_FEATURES (RUN_HOOKS | RUN_TRACE | RUN_PROFILE)
+#include "runloop.h"
+
+static const runloop_t run_loops[8] = {
+    runLoop, runLoopHooks, runLoopTrace, runLoopHooksTrace,
+    runLoopProfile, runLoopHooksProfile, runLoopTraceProfile, runLoopAll
+};
+
+/* Closed-form loops only skip instructions nothing needs to see one by one */
+#define RUNLOOP_NAME runLoopLoops
+#define RUNLOOP_FEATURES RUN_LOOPS
+#include "runloop.h"
+
+static runloop_t selectRunLoop() {
+    int features = 0;
+
+    if (callexternal) { features |= RUN_HOOKS; }
+    if (trace_file != NULL) { features |= RUN_TRACE; }
+    if (flag_profile) { features |= RUN_PROFILE; }
+
+    if (features == 0 && flag_fastloops) { return runLoopLoops; }
+
+    return run_loops[features];
+}
 
 static struct option long_options[] = {
     {"sidfile", required_argument, 0, 'f'},
@@ -40,10 +405,45 @@ static struct option long_options[] = {
     {"flipflopaddr", required_argument, 0, 'i'},
     {"framecounteraddr", required_argument, 0, 't'},
     {"includeregions", optional_argument, 0, 'g'},
+    {"watch", required_argument, 0, 'w'},
+    {"watchhits", required_argument, 0, 'n'},
+    {"corpus", required_argument, 0, 'C'},
+    {"jobs", required_argument, 0, 'j'},
+    {"store", required_argument, 0, 'S'},
+    {"deltas", required_argument, 0, 'a'},
+    {"trace", required_argument, 0, 'T'},
+    {"output", required_argument, 0, 'O'},
+    {"diffaddr", required_argument, 0, 'A'},
+    {"subtune", required_argument, 0, 'u'},
+    {"chunklines", required_argument, 0, 'L'},
+    {"telemetry", required_argument, 0, 'M'},
+    {"telemetryinterval", required_argument, 0, 'I'},
+    {"rasterbudget", required_argument, 0, 'R'},
+    {"hangcycles", required_argument, 0, 'H'},
+    {"seek", required_argument, 0, 'J'},
     {"help", no_argument, 0, 'h'},
     {"ignoresidregs", no_argument, &flag_ignoresidregs, 'r'},
     {"overwrite", no_argument, &flag_overwrite, 'o'},
     {"verbose", no_argument, &flag_verbose, 'v'},
+    {"watchstop", no_argument, &flag_watchstop, 'e'},
+    {"corpusdiffs", no_argument, &flag_corpusdiffs, 'D'},
+    {"profile", no_argument, &flag_profile, 'P'},
+    {"liveness", no_argument, &flag_liveness, 'Z'},
+    {"baseline", no_argument, &flag_baseline, 'B'},
+    {"memoise", no_argument, &flag_memo, 'm'},
+    {"fastloops", no_argument, &flag_fastloops, 'X'},
+    {"audiofloat", no_argument, &flag_audiofloat, 'U'},
+    {"sidlog", required_argument, 0, 'W'},
+    {"find", required_argument, 0, 'F'},
+    {"findmask", required_argument, 0, 'G'},
+    {"schedule", required_argument, 0, 'E'},
+    {"slicecycles", required_argument, 0, 'k'},
+    {"checkpoints", required_argument, 0, 'K'},
+    {"tunecycles", required_argument, 0, 'b'},
+    {"load", required_argument, 0, 'z'},
+    {"audio", required_argument, 0, 'V'},
+    {"audiorate", required_argument, 0, 'N'},
+    {"audioquality", required_argument, 0, 'q'},
     {0, 0, 0, 0}
 };
 
@@ -67,7 +467,7 @@ void printHelp() {
     }
 }
 
-void loadFile(const char* filename, const ushort loadAddress, const ushort skipBytes) {
+int loadFile(const char* filename, const ushort loadAddress, const ushort skipBytes) {
     FILE * fp = fopen(filename, "r");
 
     if (!fp) { 
@@ -89,8 +489,13 @@ void loadFile(const char* filename, const ushort loadAddress, const ushort skipB
     printf("Bytes read: %d\n", bytesRead);
 
     fclose(fp);
+
+    return bytesRead;
 }
 
+/* incFrameCounter in player.asm, from the start of player.prg */
+#define PLAYERFRAMESTEP 0x1a
+
 uint16_t loadPrg(const char* filename) {
     FILE * fp = fopen(filename, "rb");
 
@@ -121,6 +526,36 @@ uint16_t loadPrg(const char* filename) {
 void clearMemory(uint8 value) {
     memset(memory, value, sizeof(memory)/sizeof(memory[0]));
     memset(memory_changes, 0, sizeof(memory)/sizeof(memory[0]));
+    touchMemory(0, MEMSIZE - 1);
+}
+
+void touchMemory(uint32_t startAddr, uint32_t endAddr) {
+    memset(page_dirty + (startAddr >> 8), 1, (endAddr >> 8) - (startAddr >> 8) + 1);
+}
+
+/* Takes the loaded image as the template, the change flags must be clear */
+void templateCapture(template_t* t, uint16_t playerStartAddress) {
+    memcpy(t->memory, memory, MEMSIZE);
+    t->start = playerStartAddress;
+
+    memset(page_dirty, 0, sizeof(page_dirty));
+}
+
+/* Puts the template back by copying only the pages touched since, the
+   caller then starts it with startMusic() */
+void templateReset(const template_t* t) {
+    int restored = 0;
+
+    for (uint32_t page = 0; page < MEMSIZE / 256; page++) {
+        if (!page_dirty[page]) { continue; }
+
+        memcpy(memory + page * 256, t->memory + page * 256, 256);
+        memset(memory_changes + page * 256, 0, 256);
+        page_dirty[page] = 0;
+        restored++;
+    }
+
+    verbose("Template reset, %d pages restored\n", restored);
 }
 
 void printChanges() {
@@ -137,7 +572,77 @@ void printChanges() {
     printf("Total changes: %d places\n", count);
 }
 
-void saveChanges(const char* filename, bool overwrite) {
+/* Writes the marked bytes of values as an LDX/STX routine, grouped by value
+   so that consecutive values can use INX instead of LDX. The first group
+   takes an INX when its value is one above previousChange. */
+static void writeRoutine(FILE* fp, const uint8_t* values, const uint8_t* changes, int previousChange) {
+    static uint16_t order[MEMSIZE];
+    uint32_t start[257] = { 0 };
+
+    for (uint32_t i = 0; i < MEMSIZE; i++) {
+        if (changes[i] != 0) { start[values[i] + 1]++; }
+    }
+
+    for (uint32_t b = 0; b < 256; b++) {
+        start[b + 1] += start[b];
+    }
+
+    uint32_t fill[256];
+    memcpy(fill, start, sizeof(fill));
+
+    for (uint32_t i = 0; i < MEMSIZE; i++) {
+        if (changes[i] != 0) { order[fill[values[i]]++] = (uint16_t)i; }
+    }
+
+    uint8_t ldx[] = { 0xa2, 0x00 };
+    uint8_t inx[] = { 0xe8 };
+    uint8_t stx[] = { 0x8e, 0x00, 0x00 };
+
+    for (uint32_t b = 0; b <= 255; b++) {
+        if (start[b] == start[b + 1]) { continue; }
+
+        ldx[1] = (b & 255);
+
+        if (previousChange + 1 == ldx[1]) {
+            fwrite(inx, 1, sizeof(inx), fp);
+        } else {
+            fwrite(ldx, 1, sizeof(ldx), fp);
+        }
+
+        for (uint32_t n = start[b]; n < start[b + 1]; n++) {
+            stx[1] = (order[n] & 255);
+            stx[2] = (order[n] >> 8) & 255;
+
+            fwrite(stx, 1, sizeof(stx), fp);
+        }
+
+        previousChange = ldx[1];
+    }
+
+    uint8_t rts[] = { 0x60 };
+    fwrite(rts, 1, sizeof(rts), fp);
+}
+
+/* A bare diff is entered with X = 0, so a first value of 1 takes an INX */
+void writeDiff(FILE* fp, const uint8_t* values, const uint8_t* changes) {
+    writeRoutine(fp, values, changes, 0);
+}
+
+/* For routines run after other code, as in the PRG and PSID outputs. No
+   value is one above -2, so the first group always loads X. */
+void writeStandaloneDiff(FILE* fp, const uint8_t* values, const uint8_t* changes) {
+    writeRoutine(fp, values, changes, -2);
+}
+
+/* Outputs may be hard links into the diff store, so an existing file is
+   replaced by a new inode instead of being truncated in place */
+FILE* createFile(const char* filename, const char* mode) {
+    unlink(filename);
+
+    return fopen(filename, mode);
+}
+
+void saveChanges(const char* filename, bool overwrite, const uint8_t* values, const uint8_t* changes) {
     FILE * fp = NULL;
 
     if (!overwrite) {
@@ -148,48 +653,38 @@ void saveChanges(const char* filename, bool overwrite) {
         }
     }
 
-    fp = fopen(filename, "wb");
+    fp = createFile(filename, "wb");
 
     if (!fp) {
         printf("Couldn't create diff file `%s`. Exiting...\n", filename);
         exit(1);
     }
 
-    uint8_t ldx[] = { 0xa2, 0x00 };
-    uint8_t inx[] = { 0xe8 };
-    uint8_t stx[] = { 0x8e, 0x00, 0x00 };
-
-    uint8_t previousChange = 0x00;
-
-    for (uint32_t b = 0; b <= 255; b++) {
-        bool ldxDone = false;
-        ldx[1] = (b & 255);
+    writeDiff(fp, values, changes);
 
-        for (uint32_t i = 0; i < MEMSIZE; i++) {
-            if (memory_changes[i] != 0 && memory[i] == ldx[1]) {
-                stx[1] = (i & 255);
-                stx[2] = (i >> 8) & 255;
+    fclose(fp);
+}
 
-                if (!ldxDone) {
-                    if (previousChange + 1 == ldx[1]) {
-                        fwrite(inx, 1, sizeof(inx), fp);
-                    } else {
-                        fwrite(ldx, 1, sizeof(ldx), fp);
-                    }
+/* The PSID header of the tune, for outputs that need the init and play addresses */
+static void loadPsid(const char* filename, psid_t* psid) {
+    static uint8_t file[MEMSIZE + 0x200];
 
-                    ldxDone = true;
-                }
+    FILE* fp = fopen(filename, "rb");
 
-                fwrite(stx, 1, sizeof(stx), fp);
-                previousChange = ldx[1];
-            }
-        }
+    if (!fp) {
+        printf("Couldn't open file `%s`. Exiting...\n", filename);
+        exit(1);
     }
 
-    uint8_t rts[] = { 0x60 };
-    fwrite(rts, 1, sizeof(rts), fp);
-
+    size_t size = fread(file, 1, sizeof(file), fp);
     fclose(fp);
+
+    int status = psidParse(file, size, psid);
+
+    if (status != PSID_OK) {
+        printf("PSID output needs a PSID tune, `%s`: %s. Exiting...\n", filename, psidError(status));
+        exit(1);
+    }
 }
 
 void printMemory() {
@@ -213,128 +708,1547 @@ void printMemory() {
     }
 }
 
-void playMusic(uint16_t playerStartAddress, uint16_t frameCounterAddress, uint16_t frameChangedAddress, int maxFrames) {
+void startMusic(uint16_t playerStartAddress) {
+    a = x = y = 0;
+    setstatus6502(0);
     reset6502();
 
     pc = playerStartAddress;
 
-    uint8_t flipflop = memory[frameChangedAddress];
-
-    long long sanitycounter = MAXFRAMES;
-    int frame = 0;
+    current_frame = 0;
+    memset(&play_stats, 0, sizeof(play_stats));
+    memset(loop_none, 0, sizeof(loop_none));
 
-    verbose("Processing: ");
+    for (int i = 0; i < MEMSIZE; i++) {
+        write_trap[i] = (write_trap[i] & ~TRAP_WATCH) | (watch_map[i] ? TRAP_WATCH : 0);
+    }
+}
 
-    while (--sanitycounter > 0 && frame < maxFrames) {
-        step6502();
+/* Instructions single-stepped per watchdog probe, and PCs kept for the report */
+#define PROBESTEPS 1024
+#define PCHISTORY 16
+
+static const char* watchdog_reason = NULL;
+static ushort watchdog_pcs[PCHISTORY];
+static uint32_t watchdog_pcpos = 0;
+
+/* Single-steps an overlong frame looking for a provable hang: the whole
+   machine state coming back unchanged, either from the start of the probe
+   or from the first BRK in it. The core has no interrupts or I/O, so a
+   repeated state repeats forever. Anything else is left to the budget. */
+static bool watchdogProbe(runloop_t run) {
+    static uint8 before[MEMSIZE];
+    static uint8 atBrk[MEMSIZE];
+
+    ushort startPc = pc;
+    uint8 startA = a, startX = x, startY = y, startSp = sp, startStatus = getstatus6502();
+
+    ushort brkPc = 0;
+    uint8 brkA = 0, brkX = 0, brkY = 0, brkSp = 0, brkStatus = 0;
+    bool brkSeen = false;
+
+    memcpy(before, memory, MEMSIZE);
+
+    for (int i = 0; i < PROBESTEPS && !frame_done; i++) {
+        ushort at = pc;
+        watchdog_pcs[watchdog_pcpos++ % PCHISTORY] = at;
+
+        if (memory[at] == 0x00) {
+            if (!brkSeen) {
+                brkPc = at;
+                brkA = a, brkX = x, brkY = y, brkSp = sp, brkStatus = getstatus6502();
+                memcpy(atBrk, memory, MEMSIZE);
+                brkSeen = true;
+            } else if (at == brkPc && a == brkA && x == brkX && y == brkY && sp == brkSp &&
+                       getstatus6502() == brkStatus && memcmp(memory, atBrk, MEMSIZE) == 0) {
+                watchdog_reason = "BRK loop";
+                return true;
+            }
+        }
 
-        if (flipflop != memory[frameChangedAddress]) {
-            flipflop = memory[frameChangedAddress];
-            
-            frame = memory[frameCounterAddress] + (memory[frameCounterAddress + 1] << 8) + 
-                    (memory[frameCounterAddress + 2] << 16) + (memory[frameCounterAddress + 3] << 24);
+        run(1);
 
-            if (flag_verbose) {
-                if (frame % 3007 == 0) { putchar('.'); }
-            }
+        if (pc == startPc && a == startA && x == startX && y == startY && sp == startSp &&
+            getstatus6502() == startStatus && memcmp(memory, before, MEMSIZE) == 0) {
+            watchdog_reason = pc == at ? "stuck PC" : "endless loop";
+            return true;
         }
     }
 
-    if (sanitycounter == 0) {
-        printf("SANITY COUNTER OVERFLOWED! Exiting...\n");
-        exit(1);
-    }
+    return false;
+}
 
-    verbose(". DONE!\n");
+/* The hang budget of the current frame, the first one includes init */
+static uint32_t frameBudget() {
+    if (play_stats.cycles > 0) { return watchdog.hangCycles; }
+
+    return watchdog.initCycles > watchdog.hangCycles ? watchdog.initCycles : watchdog.hangCycles;
 }
 
-void ignoreRegion(uint16_t startAddr, uint16_t endAddr) {
-    int s = startAddr < endAddr ? startAddr : endAddr;
-    int e = startAddr > endAddr ? startAddr : endAddr;
+/* Prints why playMusic() gave up */
+void watchdogReport() {
+    printf("Watchdog: %s at PC 0x%04x in frame %d after %u cycles (budget %u)\n",
+           watchdog_reason ? watchdog_reason : "cycle budget exhausted", pc, current_frame + 1,
+           play_stats.frameCycles, frameBudget());
 
-    if (s == e) {
-        verbose("Ignoring address 0x%04x\n", s);
-    } else {
-        verbose("Ignoring region 0x%04x - 0x%04x\n", s, e);
+    if (play_stats.cycles > 0) {
+        printf("Watchdog: last frames took at most %u cycles\n", play_stats.maxFrameCycles);
     }
 
-    for (int i = s; i <= e; i++) {
-        memory_changes[i] = 0;
-    }
-}
+    uint32_t count = watchdog_pcpos < PCHISTORY ? watchdog_pcpos : PCHISTORY;
 
-void includeRegion(uint16_t startAddr, uint16_t endAddr) {
-    int s = startAddr < endAddr ? startAddr : endAddr;
-    int e = startAddr > endAddr ? startAddr : endAddr;
+    if (count > 0) {
+        printf("Watchdog: PC history");
 
-    if (s == e) {
-        verbose("Including address 0x%04x\n", s);
-    } else {
-        verbose("Including region 0x%04x - 0x%04x\n", s, e);
-    }
+        for (uint32_t i = watchdog_pcpos - count; i < watchdog_pcpos; i++) {
+            printf(" %04x", watchdog_pcs[i % PCHISTORY]);
+        }
 
-    for (int i = s; i <= e; i++) {
-        memory_changes[i] = 1;
+        putchar('\n');
     }
 }
 
-int main(int argc, char** argv) {
-    printf("SIDulator v%s - Pre-replays a sid file to the correct position and saves the diff\n", VERSION);
+/* Runs until maxFrames frames have been played since startMusic(). Can be
+   called again with a higher maxFrames to continue from where it stopped.
+   Returns the frame reached, or -1 if the watchdog stopped a hung frame. */
+int playMusic(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int maxFrames) {
+    runloop_t run = selectRunLoop();
 
-    int c = 0;
+    frame_flipflop = memory[frameChangedAddress];
+    write_trap[frameChangedAddress] |= TRAP_FRAME;
 
-    char* sid_filename = NULL;
-    char* diff_filename = NULL;
-    char* playerprg_filename = NULL;
-    char* loadaddr_str = NULL;
-    char* framecount_str = NULL;
-    char* skipbytes_str = NULL;
-    char* flipflopaddr_str = NULL;
-    char* framecounteraddr_str = NULL;
-    char* includeregions_str = NULL;
+    /* Every instruction takes at least two cycles, so a slice that runs out
+       has used up at least the raster budget */
+    uint32_t budget = watchdog.rasterCycles < watchdog.hangCycles ? watchdog.rasterCycles : watchdog.hangCycles;
+    long long slice = budget / 2 + 1;
+    int frame = current_frame;
+    bool hung = false;
 
-    do {
-        int option_index = 0;
-        c = getopt_long(argc, argv, "f:s:l:d:c:p:i:t:g:hrov", long_options, &option_index);
+    bool watching = watchCount() > 0;
 
-        if (c < 0) { break; }
+    watchdog_reason = NULL;
+    watchdog_pcpos = 0;
 
-        switch (c) {
-            case 0:
-                /* If this option set a flag, do nothing else now. */
-                if (long_options[option_index].flag != 0) { break; }
+    verbose("Processing: ");
 
-                printf("option %s", long_options[option_index].name);
+    while (frame < maxFrames) {
+        frame_done = false;
 
-                if (optarg) {
-                    printf(" with arg %s\n", optarg);
+        if (!memo_enabled || !memoReplay()) {
+            if (memo_recording) { memoStart(); }
+
+            run(slice);
+
+            uint32_t hangCycles = frameBudget();
+
+            while (!frame_done) {
+                if (play_stats.frameCycles >= hangCycles || watchdogProbe(run)) {
+                    if (watchdog_reason == NULL) { watchdog_pcs[watchdog_pcpos++ % PCHISTORY] = pc; }
+                    hung = true;
+                    break;
                 }
-                break;
 
-            case 'v':
-                verbose("Verbose mode\n");
-                flag_verbose = 'v';
-                break;
+                if (!frame_done) { run(slice); }
+            }
 
-            case 'o':
-                verbose("Overwrite existing .diff-file\n");
-                flag_overwrite = 'o';
-                break;
-            
-            case 'r':
-                verbose("Ignore changes in SID registers\n");
-                flag_ignoresidregs = 'r';
-                break;
+            if (hung) { break; }
+            if (memo_recording) {
+                memoFinish();
+                if (!memo_recording) { run = selectRunLoop(); }
+            } else if (memo_enabled) {
+                memoCount(false);
+            }
+        }
 
-            case 'h':
-                printHelp();
-                exit(0);
-                break;
+        frame = memory[frameCounterAddress] + (memory[frameCounterAddress + 1] << 8) + 
+                (memory[frameCounterAddress + 2] << 16) + (memory[frameCounterAddress + 3] << 24);
 
-            case 'l':
-                verbose("loadaddr=`%s`\n", optarg);
-                loadaddr_str = optarg;
-                break;
+        if (play_stats.frameCycles > watchdog.rasterCycles && play_stats.cycles > 0) {
+            if (play_stats.overruns++ == 0) { play_stats.firstOverrun = frame; }
+        }
+
+        play_stats.cycles += play_stats.frameCycles;
+        if (cycle_meter != NULL) { __atomic_fetch_add(cycle_meter, play_stats.frameCycles, __ATOMIC_RELAXED); }
+        if (play_stats.frameCycles > play_stats.maxFrameCycles) { play_stats.maxFrameCycles = play_stats.frameCycles; }
+        play_stats.frameCycles = 0;
+
+        if (flag_verbose) {
+            if (frame % 3007 == 0) { putchar('.'); }
+        }
+
+        if (journal_enabled) { journalMark(frame); }
+        if (events_enabled) { eventsPush(EVENT_FRAME, play_stats.cycles, frame, 0, 0); }
+        if (telemetry_enabled && frame % TELEMETRYFRAMES == 0) { telemetryFrame(frame); }
+
+        if (find_enabled) {
+            uint8 regs[] = { a, x, y, sp, getstatus6502(), pc & 0xff, pc >> 8 };
+
+            if (findFrameDone(frame, hash64(regs, sizeof(regs), HASH_INIT))) {
+                verbose(" search done at frame %d", frame);
+                break;
+            }
+        }
+
+        if (watching && watchFrameDone(frame) && flag_watchstop) {
+            verbose(" watches matched at frame %d", frame);
+            break;
+        }
+    }
+
+    write_trap[frameChangedAddress] &= ~TRAP_FRAME;
+    current_frame = frame;
+
+    if (events_enabled) { eventsPush(EVENT_SNAPSHOT, play_stats.cycles, frame, 0, 0); }
+
+    if (hung) { return -1; }
+
+    verbose(". DONE!\n");
+
+    return frame;
+}
+
+/*
+ * Undo journal for seeking backwards. While enabled, the first write to an
+ * address in a frame logs its old value and change flag, and clears the
+ * address's TRAP_JOURNAL bit so later writes in that frame take the fast
+ * path. Every frame boundary keeps the registers and statistics. Stepping
+ * back undoes the logged frames newest first. The journal keeps the last
+ * MAXJOURNALFRAMES frames; a full snapshot every SNAPSHOTFRAMES frames
+ * covers seeks further back or ahead, which replay from the nearest one.
+ */
+#define MAXJOURNALFRAMES 5000
+#define SNAPSHOTFRAMES 5000
+#define MAXSNAPSHOTS 4096
+
+typedef struct {
+    cpustate_t state;           /* at the frame boundary */
+    uint32_t firstEntry;        /* undo entries of the frame that follows */
+} journalframe_t;
+
+typedef struct {
+    ushort addr;
+    uint8 value;
+    uint8 changed;
+} journalentry_t;
+
+typedef struct {
+    cpustate_t state;
+    uint8* memory;
+    uint8* changes;
+} snapshot_t;
+
+static journalframe_t* journal_frames = NULL;
+static uint32_t journal_framecount = 0;
+static uint32_t journal_framesize = 0;
+
+static journalentry_t* journal_entries = NULL;
+static uint32_t journal_entrycount = 0;
+static uint32_t journal_entrysize = 0;
+
+static snapshot_t snapshots[MAXSNAPSHOTS];
+static int snapshot_count = 0;
+
+static void saveState(cpustate_t* state) {
+    state->frame = current_frame;
+    state->pc = pc;
+    state->a = a; state->x = x; state->y = y; state->sp = sp;
+    state->status = getstatus6502();
+    state->stats = play_stats;
+}
+
+static void restoreState(const cpustate_t* state) {
+    current_frame = state->frame;
+    pc = state->pc;
+    a = state->a; x = state->x; y = state->y; sp = state->sp;
+    setstatus6502(state->status);
+    play_stats = state->stats;
+}
+
+/* Suspends the running machine into context. Only the pages dirtied since
+   contextLoad() are copied, the rest is still in the context from then. */
+void contextSave(context_t* context) {
+    for (uint32_t page = 0; page < MEMSIZE / 256; page++) {
+        if (!page_dirty[page] && context->saved) { continue; }
+
+        memcpy(context->memory + page * 256, memory + page * 256, 256);
+        memcpy(context->changes + page * 256, memory_changes + page * 256, 256);
+    }
+
+    saveState(&context->state);
+    context->saved = true;
+}
+
+void contextLoad(const context_t* context) {
+    memcpy(memory, context->memory, MEMSIZE);
+    memcpy(memory_changes, context->changes, MEMSIZE);
+    memset(page_dirty, 0, sizeof(page_dirty));
+
+    restoreState(&context->state);
+}
+
+static void journalWrite(ushort addr) {
+    if (journal_entrycount == journal_entrysize) {
+        journal_entrysize = journal_entrysize ? journal_entrysize * 2 : 65536;
+        journal_entries = realloc(journal_entries, journal_entrysize * sizeof(journalentry_t));
+    }
+
+    journalentry_t* e = &journal_entries[journal_entrycount++];
+    e->addr = addr;
+    e->value = memory[addr];
+    e->changed = change_map[addr];
+
+    write_trap[addr] &= ~TRAP_JOURNAL;
+}
+
+static void takeSnapshot() {
+    if (snapshot_count == MAXSNAPSHOTS) { return; }
+
+    int i = snapshot_count;
+    while (i > 0 && snapshots[i - 1].state.frame >= current_frame) { i--; }
+
+    if (i < snapshot_count && snapshots[i].state.frame == current_frame) { return; }
+
+    memmove(&snapshots[i + 1], &snapshots[i], (snapshot_count - i) * sizeof(snapshot_t));
+    snapshot_count++;
+
+    snapshot_t* snap = &snapshots[i];
+    saveState(&snap->state);
+    snap->memory = malloc(MEMSIZE);
+    snap->changes = malloc(MEMSIZE);
+    memcpy(snap->memory, memory, MEMSIZE);
+    memcpy(snap->changes, change_map, MEMSIZE);
+}
+
+/* Closes the frame being logged and opens the next one at frame */
+static void journalMark(int frame) {
+    uint32_t first = journal_framecount > 0 ? journal_frames[journal_framecount - 1].firstEntry : 0;
+
+    for (uint32_t i = first; i < journal_entrycount; i++) { write_trap[journal_entries[i].addr] |= TRAP_JOURNAL; }
+
+    /* Forget the oldest half once the window is full */
+    if (journal_framecount >= MAXJOURNALFRAMES) {
+        uint32_t drop = journal_framecount / 2;
+        uint32_t dropEntries = journal_frames[drop].firstEntry;
+
+        memmove(journal_frames, journal_frames + drop, (journal_framecount - drop) * sizeof(journalframe_t));
+        memmove(journal_entries, journal_entries + dropEntries, (journal_entrycount - dropEntries) * sizeof(journalentry_t));
+
+        journal_framecount -= drop;
+        journal_entrycount -= dropEntries;
+
+        for (uint32_t i = 0; i < journal_framecount; i++) { journal_frames[i].firstEntry -= dropEntries; }
+    }
+
+    if (journal_framecount == journal_framesize) {
+        journal_framesize = journal_framesize ? journal_framesize * 2 : 1024;
+        journal_frames = realloc(journal_frames, journal_framesize * sizeof(journalframe_t));
+    }
+
+    journalframe_t* jf = &journal_frames[journal_framecount++];
+    int savedframe = current_frame;
+
+    current_frame = frame;
+    saveState(&jf->state);
+    jf->firstEntry = journal_entrycount;
+
+    if (frame % SNAPSHOTFRAMES == 0) { takeSnapshot(); }
+
+    current_frame = savedframe;
+}
+
+static void journalReset() {
+    journal_framecount = 0;
+    journal_entrycount = 0;
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] |= TRAP_JOURNAL; }
+
+    journalMark(current_frame);
+}
+
+/* Starts journaling from the current position */
+void journalBegin() {
+    journal_enabled = true;
+
+    takeSnapshot();
+    journalReset();
+}
+
+void journalEnd() {
+    journal_enabled = false;
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] &= ~TRAP_JOURNAL; }
+    for (int i = 0; i < snapshot_count; i++) {
+        free(snapshots[i].memory);
+        free(snapshots[i].changes);
+    }
+
+    free(journal_frames);
+    free(journal_entries);
+
+    journal_frames = NULL;
+    journal_entries = NULL;
+    journal_framecount = journal_framesize = 0;
+    journal_entrycount = journal_entrysize = 0;
+    snapshot_count = 0;
+}
+
+/* Undoes frames down to the journaled boundary at index */
+static void journalRewind(uint32_t index) {
+    uint32_t first = journal_frames[index].firstEntry;
+
+    for (uint32_t i = journal_entrycount; i-- > first; ) {
+        const journalentry_t* e = &journal_entries[i];
+
+        memory[e->addr] = e->value;
+        change_map[e->addr] = e->changed;
+        page_dirty[e->addr >> 8] = 1;
+        write_trap[e->addr] |= TRAP_JOURNAL;
+    }
+
+    restoreState(&journal_frames[index].state);
+
+    journal_entrycount = first;
+    journal_framecount = index + 1;
+}
+
+static void restoreSnapshot(const snapshot_t* snap) {
+    memcpy(memory, snap->memory, MEMSIZE);
+    memcpy(change_map, snap->changes, MEMSIZE);
+    touchMemory(0, MEMSIZE - 1);
+    restoreState(&snap->state);
+
+    journalReset();
+}
+
+/* Moves to frame in either direction: undoes journaled frames, or jumps to
+   the nearest snapshot, then plays forward for whatever is left. Starts
+   the journal if needed. Returns the frame reached, or -1 if frame lies
+   before the first snapshot or the watchdog stopped the replay. */
+int seekFrame(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int frame) {
+    if (!journal_enabled) { journalBegin(); }
+
+    if (frame < current_frame && journal_framecount > 0 && journal_frames[0].state.frame <= frame) {
+        uint32_t index = journal_framecount - 1;
+        while (index > 0 && journal_frames[index].state.frame > frame) { index--; }
+
+        journalRewind(index);
+    } else if (frame != current_frame) {
+        const snapshot_t* best = NULL;
+
+        for (int i = 0; i < snapshot_count && snapshots[i].state.frame <= frame; i++) { best = &snapshots[i]; }
+
+        if (best == NULL) { return -1; }
+
+        /* Backwards past the journal, or far enough ahead that a snapshot is closer */
+        if (frame < current_frame || best->state.frame > current_frame) { restoreSnapshot(best); }
+    }
+
+    if (current_frame == frame) { return frame; }
+
+    return playMusic(frameCounterAddress, frameChangedAddress, frame);
+}
+
+static uint8* observe_access = NULL;
+static ushort observe_pc = 0;
+
+/* Optional list of the addresses that got their first mark */
+static ushort* observe_touched = NULL;
+static uint32_t observe_touchedcount = 0;
+
+static void observeRead(ushort addr) {
+    if (observe_touched != NULL && observe_access[addr] == 0) { observe_touched[observe_touchedcount++] = addr; }
+    if (!(observe_access[addr] & (ACCESS_LIVE | ACCESS_DEAD))) { observe_access[addr] |= ACCESS_LIVE; }
+
+    observe_access[addr] |= ACCESS_READ;
+}
+
+static void observeWrite(ushort addr) {
+    if (observe_touched != NULL && observe_access[addr] == 0) { observe_touched[observe_touchedcount++] = addr; }
+    if (!(observe_access[addr] & (ACCESS_LIVE | ACCESS_DEAD))) { observe_access[addr] |= ACCESS_DEAD; }
+}
+
+/* Marks what the instruction that started at observe_pc read and wrote, in
+   that order. Runs as the fake6502 hook, so read6502() and write6502() stay
+   free of bookkeeping. Stack writes aren't followed, the stack never goes
+   into a diff. */
+static void observeInstruction() {
+    ushort at = observe_pc;
+    void (*mode)() = addrtable[opcode];
+    void (*op)() = optable[opcode];
+
+    observe_pc = pc;
+
+    observeRead(at);
+
+    if (mode == abso || mode == absx || mode == absy || mode == ind) {
+        observeRead((ushort)(at + 1));
+        observeRead((ushort)(at + 2));
+    } else if (mode != imp && mode != acc) {
+        observeRead((ushort)(at + 1));
+    }
+
+    /* Pointers */
+    if (mode == ind) {
+        ushort ptr = memory[(ushort)(at + 1)] | (memory[(ushort)(at + 2)] << 8);
+        observeRead(ptr);
+        observeRead((ptr & 0xff00) | ((ptr + 1) & 0xff));
+    } else if (mode == indx || mode == indy) {
+        uint8 zp = memory[(ushort)(at + 1)] + (mode == indx ? x : 0);
+        observeRead(zp);
+        observeRead((uint8)(zp + 1));
+    }
+
+    bool memoryMode = mode != imp && mode != acc && mode != imm && mode != rel;
+    bool store = op == sta || op == stx || op == sty || op == sax;
+    bool modify = op == asl || op == lsr || op == rol || op == ror || op == inc || op == dec ||
+                  op == slo || op == rla || op == sre || op == rra || op == dcp || op == isb;
+
+    /* Operand, read-modify-write reads before it writes */
+    if (memoryMode && !store && op != jmp && op != jsr) { observeRead(ea); }
+    if (memoryMode && (store || modify)) { observeWrite(ea); }
+
+    /* Stack and vectors */
+    if (op == pla || op == plp) {
+        observeRead(0x100 + sp);
+    } else if (op == rts || op == rti) {
+        for (int i = (op == rts ? 1 : 2); i >= 0; i--) { observeRead(0x100 + (uint8)(sp - i)); }
+    } else if (op == brk_6502) {
+        observeRead(0xfffe);
+        observeRead(0xffff);
+    }
+}
+
+/* Plays `frames` more frames recording the access order of every address
+   into access (ACCESS_* bits), then rewinds memory and CPU to where they were */
+void observeAccess(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int frames, uint8_t* access) {
+    static uint8 saved[MEMSIZE];
+    memcpy(saved, memory, sizeof(saved));
+
+    ushort savedpc = pc;
+    uint8 saveda = a, savedx = x, savedy = y, savedsp = sp, savedstatus = getstatus6502();
+    playstats_t savedstats = play_stats;
+    int savedframe = current_frame;
+    uint8* savedchanges = change_map;
+    void (*savedhook)() = loopexternal;
+    uint8 savedcall = callexternal;
+    bool savedjournal = journal_enabled;
+    bool savedmemo = memo_enabled;
+    bool savedrecording = memo_recording;
+    bool savedevents = events_enabled;
+    ushort* savedtouched = observe_touched;
+
+    if (journal_enabled) { for (int i = 0; i < MEMSIZE; i++) { write_trap[i] &= ~TRAP_JOURNAL; } }
+    journal_enabled = false;
+    memo_enabled = false;
+    memo_recording = false;
+    events_enabled = false;
+    observe_touched = NULL;
+
+    verbose("Observing memory accesses for %d frames\n", frames);
+
+    change_map = change_sink;
+    observe_access = access;
+    observe_pc = pc;
+    hookexternal(observeInstruction);
+
+    playMusic(frameCounterAddress, frameChangedAddress, current_frame + frames);
+
+    loopexternal = savedhook;
+    callexternal = savedcall;
+    change_map = savedchanges;
+
+    memcpy(memory, saved, sizeof(saved));
+    pc = savedpc;
+    a = saveda; x = savedx; y = savedy; sp = savedsp;
+    setstatus6502(savedstatus);
+    play_stats = savedstats;
+    current_frame = savedframe;
+
+    memo_enabled = savedmemo;
+    memo_recording = savedrecording;
+    events_enabled = savedevents;
+    observe_touched = savedtouched;
+
+    /* Back at the same frame boundary, nothing logged for the next frame yet */
+    if (savedjournal) {
+        journal_enabled = true;
+        for (int i = 0; i < MEMSIZE; i++) { write_trap[i] |= TRAP_JOURNAL; }
+    }
+}
+
+/* Replays the tune from its loaded image to frame first and on to frame
+   repeat, and compares the whole state at both but the frame counter. The
+   machine is left at frame repeat, where the search stopped. */
+static bool replayLoop(const uint8_t* image, uint16_t playerStartAddress, uint16_t frameCounterAddress,
+                       uint16_t frameChangedAddress, int first, int repeat) {
+    static uint8 state[MEMSIZE];
+
+    bool savedevents = events_enabled;
+    bool savedtelemetry = telemetry_enabled;
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] &= ~TRAP_FIND; }
+    find_enabled = false;
+    events_enabled = false;
+    telemetry_enabled = false;
+
+    verbose("Replaying frames %d to %d to confirm the loop\n", first, repeat);
+
+    memcpy(memory, image, MEMSIZE);
+    startMusic(playerStartAddress);
+
+    bool reached = playMusic(frameCounterAddress, frameChangedAddress, first) == first;
+    uint8 regs[] = { a, x, y, sp, getstatus6502(), pc & 0xff, pc >> 8 };
+    memcpy(state, memory, MEMSIZE);
+
+    reached = playMusic(frameCounterAddress, frameChangedAddress, repeat) == repeat && reached;
+    uint8 now[] = { a, x, y, sp, getstatus6502(), pc & 0xff, pc >> 8 };
+    for (int i = 0; i < 4; i++) { state[(frameCounterAddress + i) & 0xffff] = memory[(frameCounterAddress + i) & 0xffff]; }
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] |= TRAP_FIND; }
+    find_enabled = true;
+    events_enabled = savedevents;
+    telemetry_enabled = savedtelemetry;
+
+    return reached && memcmp(regs, now, sizeof(regs)) == 0 && memcmp(state, memory, MEMSIZE) == 0;
+}
+
+
+/*
+ * Memoised frames. A recorded frame keeps the values of what it read before
+ * writing, in the order it first read them, the final values of what it
+ * wrote, and its exit registers. The reads go into a radix trie: the frame
+ * is deterministic, so the entry registers and the values read so far fix
+ * the next address it reads. Runs of reads that never differed are checked
+ * in one go; a node branches on the first address whose value did. A later
+ * frame that gets through the trie to a leaf has the recorded effect
+ * replayed instead of run. The driver's frame counter and flip-flop stay
+ * out of the key and are stepped directly, else no frame would ever repeat,
+ * so memo mode only starts when the driver's code steps them that way and
+ * every recorded frame is checked to have done so. Frames are recorded until
+ * the trie is full; after that only replays are tried. Memo mode stops itself
+ * when too few frames hit, while recording after MEMOPATIENCE windows in a row.
+ * The tables start small and double as the trie grows, up to the limits here.
+ */
+#define MAXMEMOROOTS 256
+#define MEMOROOTSLOTS 512
+#define MAXMEMONODES (1 << 20)
+#define MEMOPOOL (1 << 24)
+#define MEMOSTART 4096
+#define MEMOWINDOW 1000
+#define MINMEMOHITS 0.25
+#define MEMOPATIENCE 16
+#define MEMOINNER UINT32_MAX
+
+typedef struct {
+    uint32_t run;               /* reads to check, in memo_addrs/memo_bytes */
+    uint32_t runCount;
+    ushort addr;                /* branched on after the run by an inner node */
+    uint32_t entry;             /* MEMOINNER, or entry index + 1 for a leaf */
+} memonode_t;
+
+typedef struct {
+    uint64_t key;               /* node << 8 | value, + 1 so 0 is empty */
+    uint32_t child;
+} memoedge_t;
+
+typedef struct {
+    uint32_t writes;            /* also in memo_addrs/memo_bytes */
+    uint32_t writeCount;
+    uint8 exit[7];              /* pc lo/hi, a, x, y, sp, status */
+    uint32_t cycles;
+    uint32_t instructions;
+} memoentry_t;
+
+static uint8 memo_rootregs[MAXMEMOROOTS][7];
+static uint32_t memo_roots[MAXMEMOROOTS];
+static uint32_t memo_rootcount = 0;
+static uint16_t memo_rootslots[MEMOROOTSLOTS];     /* root index + 1, 0 is empty */
+
+static memonode_t* memo_nodes = NULL;
+static uint32_t memo_nodecount = 0;
+static uint32_t memo_nodecap = 0;
+
+static memoedge_t* memo_edges = NULL;
+static uint32_t memo_edgecount = 0;
+static uint32_t memo_edgecap = 0;           /* a power of two, kept at most half full */
+
+static memoentry_t* memo_entries = NULL;
+static uint32_t memo_entrycount = 0;
+
+static ushort* memo_addrs = NULL;
+static uint8* memo_bytes = NULL;
+static uint32_t memo_poolcount = 0;
+static uint32_t memo_poolcap = 0;
+
+static uint16_t memo_counter = 0;
+static uint16_t memo_flipflop = 0;
+
+/* Per frame recording state */
+static uint8 memo_access[MEMSIZE];
+static ushort memo_touched[MEMSIZE];
+static uint8 memo_old[MEMSIZE];
+static uint32_t memo_stamp[MEMSIZE];
+static uint32_t memo_epoch = 1;
+static ushort memo_written[MEMSIZE];
+static uint32_t memo_writtencount = 0;
+static uint8 memo_regs[7];
+static uint64_t memo_instructions = 0;
+
+static uint32_t memo_frames = 0;
+static uint32_t memo_hits = 0;
+static uint32_t memo_lowwindows = 0;
+static uint64_t memo_totalframes = 0;
+static uint64_t memo_totalhits = 0;
+
+static void memoRegs(uint8* regs) {
+    regs[0] = pc & 0xff; regs[1] = pc >> 8;
+    regs[2] = a; regs[3] = x; regs[4] = y; regs[5] = sp;
+    regs[6] = getstatus6502();
+}
+
+static bool memoDriverByte(ushort addr) {
+    return (addr >= memo_counter && addr < memo_counter + 4) || addr == memo_flipflop;
+}
+
+/* Slot of the root for the entry registers, or the empty slot it would take */
+static uint32_t memoRootSlot(const uint8* regs) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 7; i++) { hash = (hash ^ regs[i]) * 16777619u; }
+
+    uint32_t slot = hash & (MEMOROOTSLOTS - 1);
+
+    while (memo_rootslots[slot] != 0 && memcmp(memo_rootregs[memo_rootslots[slot] - 1], regs, 7) != 0) {
+        slot = (slot + 1) & (MEMOROOTSLOTS - 1);
+    }
+
+    return slot;
+}
+
+static uint32_t memoEdgeSlot(uint64_t key) {
+    uint32_t slot = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 40) & (memo_edgecap - 1);
+
+    while (memo_edges[slot].key != 0 && memo_edges[slot].key != key) { slot = (slot + 1) & (memo_edgecap - 1); }
+
+    return slot;
+}
+
+/* Edge from node on value; NULL if there is none and create is off */
+static memoedge_t* memoEdge(uint32_t node, uint8 value, bool create) {
+    uint64_t key = ((uint64_t)node << 8 | value) + 1;
+    uint32_t slot = memoEdgeSlot(key);
+
+    if (memo_edges[slot].key == 0) {
+        if (!create) { return NULL; }
+
+        memo_edges[slot].key = key;
+        memo_edges[slot].child = 0;
+        memo_edgecount++;
+    }
+
+    return &memo_edges[slot];
+}
+
+static void* memoGrow(void* array, uint32_t* capacity, uint32_t needed, size_t itemSize) {
+    if (needed <= *capacity) { return array; }
+
+    while (*capacity < needed) { *capacity *= 2; }
+    array = realloc(array, (size_t)*capacity * itemSize);
+
+    if (array == NULL) {
+        printf("Out of memory. Exiting...\n");
+        exit(1);
+    }
+
+    return array;
+}
+
+/* Room for one more frame with `pool` reads and writes */
+static void memoReserve(uint32_t pool) {
+    uint32_t nodecap = memo_nodecap;
+
+    memo_nodes = memoGrow(memo_nodes, &memo_nodecap, memo_nodecount + 2, sizeof(memonode_t));
+    memo_entries = memoGrow(memo_entries, &nodecap, memo_nodecount + 2, sizeof(memoentry_t));
+
+    uint32_t poolcap = memo_poolcap;
+
+    memo_addrs = memoGrow(memo_addrs, &memo_poolcap, memo_poolcount + pool, sizeof(ushort));
+    memo_bytes = memoGrow(memo_bytes, &poolcap, memo_poolcount + pool, 1);
+
+    if ((memo_edgecount + 2) * 2 <= memo_edgecap) { return; }
+
+    memoedge_t* old = memo_edges;
+    uint32_t oldcap = memo_edgecap;
+
+    memo_edgecap *= 2;
+    memo_edges = calloc(memo_edgecap, sizeof(memoedge_t));
+
+    if (memo_edges == NULL) {
+        printf("Out of memory. Exiting...\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < oldcap; i++) {
+        if (old[i].key != 0) { memo_edges[memoEdgeSlot(old[i].key)] = old[i]; }
+    }
+
+    free(old);
+}
+
+/* Drops the trie's tables, the counts stay for memoReport() */
+static void memoFree() {
+    free(memo_nodes);
+    free(memo_edges);
+    free(memo_entries);
+    free(memo_addrs);
+    free(memo_bytes);
+
+    memo_nodes = NULL;
+    memo_edges = NULL;
+    memo_entries = NULL;
+    memo_addrs = NULL;
+    memo_bytes = NULL;
+}
+
+static uint32_t memoNode(uint32_t run, uint32_t runCount, uint32_t entry) {
+    memonode_t* n = &memo_nodes[memo_nodecount];
+    n->run = run;
+    n->runCount = runCount;
+    n->addr = 0;
+    n->entry = entry;
+
+    return memo_nodecount++;
+}
+
+static void memoWrite(ushort addr) {
+    if (memo_stamp[addr] == memo_epoch) { return; }
+
+    memo_stamp[addr] = memo_epoch;
+    memo_old[addr] = memory[addr];
+    memo_written[memo_writtencount++] = addr;
+}
+
+/* Next instruction if the one at `at` is zpOp or absOp on addr, else 0 */
+static uint32_t memoOperand(uint32_t at, uint8 zpOp, uint8 absOp, uint16_t addr) {
+    if (addr < 0x100 && memory[at] == zpOp && memory[at + 1] == addr) { return at + 2; }
+    if (memory[at] == absOp && memory[at + 1] == (addr & 0xff) && memory[at + 2] == addr >> 8) { return at + 3; }
+
+    return 0;
+}
+
+/* Whether the code at `at` is the frame step of player.asm and psidInstall():
+   clc, lda #1, then adc/sta through the four counter bytes with adc #0 above
+   the first, then lda/eor #$ff/sta on the flip-flop */
+static bool memoDriverStep(uint32_t at) {
+    if (memory[at] != 0x18 || memory[at + 1] != 0xa9 || memory[at + 2] != 0x01) { return false; }
+
+    at += 3;
+
+    for (int i = 0; i < 4 && at != 0; i++) {
+        if (i > 0) {
+            at = memoOperand(at, 0xa5, 0xad, memo_counter + i);
+            at = at != 0 && memory[at] == 0x69 && memory[at + 1] == 0x00 ? at + 2 : 0;
+            if (at == 0) { break; }
+        } else {
+            at = memoOperand(at, 0x65, 0x6d, memo_counter);
+            if (at == 0) { break; }
+        }
+
+        at = memoOperand(at, 0x85, 0x8d, memo_counter + i);
+    }
+
+    if (at != 0) { at = memoOperand(at, 0xa5, 0xad, memo_flipflop); }
+    if (at == 0 || memory[at] != 0x49 || memory[at + 1] != 0xff) { return false; }
+
+    return memoOperand(at + 2, 0x85, 0x8d, memo_flipflop) != 0;
+}
+
+/* Starts memoising from the current position. False, and nothing started,
+   if the code at frameStepAddress, where the driver's installer put it,
+   doesn't step the frame counter and flip-flop like player.asm does, as
+   replays do it without running the driver. */
+bool memoBegin(uint16_t frameCounterAddress, uint16_t frameChangedAddress, uint16_t frameStepAddress) {
+    memo_counter = frameCounterAddress;
+    memo_flipflop = frameChangedAddress;
+
+    if (frameStepAddress >= MEMSIZE - 64 || !memoDriverStep(frameStepAddress)) { return false; }
+
+    verbose("Memo: driver frame step at $%04x\n", frameStepAddress);
+
+    memo_nodecount = memo_edgecount = memo_entrycount = memo_poolcount = memo_rootcount = 0;
+    memset(memo_rootslots, 0, sizeof(memo_rootslots));
+
+    memo_nodecap = MEMOSTART;
+    memo_edgecap = MEMOSTART * 2;
+    memo_poolcap = MEMOSTART * 16;
+
+    memo_nodes = malloc(memo_nodecap * sizeof(memonode_t));
+    memo_edges = calloc(memo_edgecap, sizeof(memoedge_t));
+    memo_entries = malloc(memo_nodecap * sizeof(memoentry_t));
+    memo_addrs = malloc(memo_poolcap * sizeof(ushort));
+    memo_bytes = malloc(memo_poolcap);
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] |= TRAP_MEMO; }
+
+    observe_access = memo_access;
+    observe_touched = memo_touched;
+    hookexternal(observeInstruction);
+
+    memo_enabled = true;
+    memo_recording = true;
+
+    return true;
+}
+
+static void memoStopRecording() {
+    memo_recording = false;
+
+    for (int i = 0; i < MEMSIZE; i++) { write_trap[i] &= ~TRAP_MEMO; }
+
+    observe_touched = NULL;
+    callexternal = 0;
+    memo_frames = 0;
+    memo_hits = 0;
+    memo_lowwindows = 0;
+}
+
+static void memoOff() {
+    if (memo_recording) { memoStopRecording(); }
+
+    memo_enabled = false;
+    memoFree();
+    verbose(" memoisation off ");
+}
+
+static void memoCount(bool hit) {
+    memo_totalframes++;
+
+    if (hit) {
+        memo_hits++;
+        memo_totalhits++;
+    }
+
+    if (++memo_frames < MEMOWINDOW) { return; }
+
+    bool low = memo_hits < MEMOWINDOW * MINMEMOHITS;
+
+    memo_lowwindows = low ? memo_lowwindows + 1 : 0;
+    memo_frames = 0;
+    memo_hits = 0;
+
+    /* Recording costs more than a run, so it gets a few windows to find repeats */
+    if (low && (!memo_recording || memo_lowwindows == MEMOPATIENCE)) { memoOff(); }
+}
+
+/* Replays the frame if the trie knows it, false if it has to run */
+static bool memoReplay() {
+    uint8 regs[7];
+    memoRegs(regs);
+
+    uint32_t slot = memoRootSlot(regs);
+    if (memo_rootslots[slot] == 0) { return false; }
+
+    const memonode_t* n = &memo_nodes[memo_roots[memo_rootslots[slot] - 1]];
+
+    for (;;) {
+        const ushort* addrs = memo_addrs + n->run;
+        const uint8* bytes = memo_bytes + n->run;
+
+        for (uint32_t i = 0; i < n->runCount; i++) {
+            if (memory[addrs[i]] != bytes[i]) { return false; }
+        }
+
+        if (n->entry != MEMOINNER) { break; }
+
+        const memoedge_t* edge = memoEdge((uint32_t)(n - memo_nodes), memory[n->addr], false);
+        if (edge == NULL) { return false; }
+
+        n = &memo_nodes[edge->child];
+    }
+
+    const memoentry_t* e = &memo_entries[n->entry - 1];
+    const ushort* addrs = memo_addrs + e->writes;
+    const uint8* bytes = memo_bytes + e->writes;
+
+    for (uint32_t i = 0; i < e->writeCount; i++) {
+        memory[addrs[i]] = bytes[i];
+        change_map[addrs[i]] = 1;
+        page_dirty[addrs[i] >> 8] = 1;
+    }
+
+    /* The driver's part of the frame */
+    for (int i = 0; i < 4 && ++memory[memo_counter + i] == 0; i++) { }
+    memory[memo_flipflop] ^= 0xff;
+    frame_flipflop = memory[memo_flipflop];
+
+    for (int i = 0; i < 4; i++) { change_map[memo_counter + i] = 1; }
+    change_map[memo_flipflop] = 1;
+    touchMemory(memo_counter, memo_counter + 3);
+    touchMemory(memo_flipflop, memo_flipflop);
+
+    pc = e->exit[0] | (e->exit[1] << 8);
+    a = e->exit[2]; x = e->exit[3]; y = e->exit[4]; sp = e->exit[5];
+    setstatus6502(e->exit[6]);
+
+    play_stats.frameCycles = e->cycles;
+    play_stats.instructions += e->instructions;
+    frame_done = true;
+
+    memoCount(true);
+    return true;
+}
+
+static void memoStart() {
+    memoRegs(memo_regs);
+    memo_instructions = play_stats.instructions;
+
+    observe_pc = pc;
+    observe_touchedcount = 0;
+    memo_writtencount = 0;
+    memo_epoch++;
+}
+
+/* Appends the recorded effect and a leaf checking reads[from..count) */
+static uint32_t memoLeaf(const ushort* reads, const uint8* values, uint32_t from, uint32_t count) {
+    uint32_t run = memo_poolcount;
+
+    memcpy(memo_addrs + run, reads + from, (count - from) * sizeof(ushort));
+    memcpy(memo_bytes + run, values + from, count - from);
+    memo_poolcount += count - from;
+
+    memoentry_t* e = &memo_entries[memo_entrycount];
+    memoRegs(e->exit);
+
+    e->writes = memo_poolcount;
+    e->writeCount = 0;
+
+    for (uint32_t i = 0; i < memo_writtencount; i++) {
+        ushort addr = memo_written[i];
+        if (memoDriverByte(addr)) { continue; }
+
+        memo_addrs[memo_poolcount] = addr;
+        memo_bytes[memo_poolcount] = memory[addr];
+        memo_poolcount++;
+        e->writeCount++;
+    }
+
+    e->cycles = play_stats.frameCycles;
+    e->instructions = (uint32_t)(play_stats.instructions - memo_instructions);
+
+    return memoNode(run, count - from, ++memo_entrycount);
+}
+
+/* Stores the frame that just ran */
+static void memoFinish() {
+    static ushort reads[MEMSIZE];
+    static uint8 values[MEMSIZE];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < observe_touchedcount; i++) {
+        ushort addr = memo_touched[i];
+
+        if ((memo_access[addr] & ACCESS_LIVE) && !memoDriverByte(addr)) {
+            reads[count] = addr;
+            values[count] = memo_stamp[addr] == memo_epoch ? memo_old[addr] : memory[addr];
+            count++;
+        }
+
+        memo_access[addr] = 0;
+    }
+
+    /* Replays step the driver bytes without running it, so each recorded
+       frame has to have stepped them exactly that way */
+    uint8 before[5], after[5];
+
+    for (int i = 0; i < 5; i++) {
+        ushort addr = i < 4 ? memo_counter + i : memo_flipflop;
+        before[i] = memo_stamp[addr] == memo_epoch ? memo_old[addr] : memory[addr];
+        after[i] = before[i];
+    }
+
+    for (int i = 0; i < 4 && ++after[i] == 0; i++) { }
+    after[4] ^= 0xff;
+
+    for (int i = 0; i < 5; i++) {
+        if (memory[i < 4 ? memo_counter + i : memo_flipflop] != after[i]) {
+            verbose(" driver bytes not stepped ");
+            memoOff();
+            return;
+        }
+    }
+
+    memoCount(false);
+    if (!memo_recording) { return; }
+
+    if (memo_nodecount + 2 > MAXMEMONODES || memo_poolcount + count + memo_writtencount > MEMOPOOL) {
+        verbose(" memo full ");
+        memoStopRecording();
+        return;
+    }
+
+    memoReserve(count + memo_writtencount);
+
+    uint32_t slot = memoRootSlot(memo_regs);
+
+    if (memo_rootslots[slot] == 0) {
+        if (memo_rootcount == MAXMEMOROOTS) {
+            verbose(" memo full ");
+            memoStopRecording();
+            return;
+        }
+
+        memcpy(memo_rootregs[memo_rootcount], memo_regs, 7);
+        memo_roots[memo_rootcount] = memoLeaf(reads, values, 0, count);
+        memo_rootslots[slot] = (uint16_t)++memo_rootcount;
+        return;
+    }
+
+    /* Walk down with the values the frame found. The same values always
+       lead to the same next read, anything else leaves the frame out. */
+    uint32_t* ref = &memo_roots[memo_rootslots[slot] - 1];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t node = *ref;
+        memonode_t* n = &memo_nodes[node];
+        uint32_t j = 0;
+
+        while (j < n->runCount && i + j < count && memo_addrs[n->run + j] == reads[i + j] &&
+               memo_bytes[n->run + j] == values[i + j]) { j++; }
+
+        if (j < n->runCount) {
+            if (i + j == count || memo_addrs[n->run + j] != reads[i + j]) { return; }
+
+            /* Split the run where the values part */
+            uint32_t head = memoNode(n->run, j, MEMOINNER);
+            memo_nodes[head].addr = reads[i + j];
+            memoEdge(head, memo_bytes[n->run + j], true)->child = node;
+
+            n->run += j + 1;
+            n->runCount -= j + 1;
+            *ref = head;
+
+            memoEdge(head, values[i + j], true)->child = memoLeaf(reads, values, i + j + 1, count);
+            return;
+        }
+
+        i += j;
+
+        if (n->entry != MEMOINNER) { return; }
+        if (i == count || n->addr != reads[i]) { return; }
+
+        memoedge_t* edge = memoEdge(node, values[i], true);
+        i++;
+
+        if (edge->child == 0) {
+            edge->child = memoLeaf(reads, values, i, count);
+            return;
+        }
+
+        ref = &edge->child;
+    }
+}
+
+void memoReport() {
+    if (memo_totalframes == 0) { return; }
+
+    printf("Memo: %llu of %llu frames replayed, %u entries, %u trie nodes\n",
+           (unsigned long long)memo_totalhits, (unsigned long long)memo_totalframes, memo_entrycount, memo_nodecount);
+}
+
+void memoEnd() {
+    if (memo_recording) { memoStopRecording(); }
+
+    memo_enabled = false;
+    memoFree();
+}
+
+void printProfile() {
+    if (!flag_profile) { return; }
+
+    uint64_t total = 0;
+    for (int i = 0; i < MEMSIZE; i++) { total += profile_cycles[i]; }
+
+    printf("Profile: %llu cycles, hottest instructions:\n", (unsigned long long)total);
+
+    /* Selection of the top 16, the table is only read once */
+    bool taken[MEMSIZE] = { false };
+
+    for (int n = 0; n < 16; n++) {
+        int best = -1;
+
+        for (int i = 0; i < MEMSIZE; i++) {
+            if (!taken[i] && profile_cycles[i] > 0 && (best < 0 || profile_cycles[i] > profile_cycles[best])) { best = i; }
+        }
+
+        if (best < 0) { break; }
+
+        taken[best] = true;
+        printf("\t0x%04x: %02x %10llu cycles %5.1f%%\n", best, memory[best],
+               (unsigned long long)profile_cycles[best], 100.0 * profile_cycles[best] / (total ? total : 1));
+    }
+
+    verbose("Opcode counts:\n");
+
+    for (int op = 0; op < 256; op++) {
+        if (profile_opcodes[op] > 0) { verbose("\t%02x: %llu\n", op, (unsigned long long)profile_opcodes[op]); }
+    }
+}
+
+void ignoreRegion(uint16_t startAddr, uint16_t endAddr) {
+    int s = startAddr < endAddr ? startAddr : endAddr;
+    int e = startAddr > endAddr ? startAddr : endAddr;
+
+    if (s == e) {
+        verbose("Ignoring address 0x%04x\n", s);
+    } else {
+        verbose("Ignoring region 0x%04x - 0x%04x\n", s, e);
+    }
+
+    for (int i = s; i <= e; i++) {
+        memory_changes[i] = 0;
+    }
+}
+
+/* Addresses asked for with -g, liveness never drops them */
+static uint8 included_map[MEMSIZE];
+
+void includeRegion(uint16_t startAddr, uint16_t endAddr) {
+    int s = startAddr < endAddr ? startAddr : endAddr;
+    int e = startAddr > endAddr ? startAddr : endAddr;
+
+    if (s == e) {
+        verbose("Including address 0x%04x\n", s);
+    } else {
+        verbose("Including region 0x%04x - 0x%04x\n", s, e);
+    }
+
+    for (int i = s; i <= e; i++) {
+        memory_changes[i] = 1;
+        included_map[i] = 1;
+    }
+
+    touchMemory(s, e);
+}
+
+void includeRegions(const char* regions) {
+    verbose("Include regions: `%s`\n", regions);
+
+    char buffer[1024];
+    strncpy(buffer, regions, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    char* tokens = ",\0";
+    char* chrptr = NULL;
+
+    chrptr = strtok(buffer, tokens);
+
+    while (chrptr != NULL) {
+        char* dashptr = strstr(chrptr, "-");
+        if (dashptr == NULL) {
+            int addr = (int)strtol(chrptr, NULL, 0);
+            includeRegion(addr, addr);
+        } else {
+            int addr_s = (int)strtol(chrptr, NULL, 0);
+            int addr_e = (int)strtol(dashptr + 1, NULL, 0);
+            includeRegion(addr_s, addr_e);
+        }
+
+        chrptr = strtok(NULL, tokens);
+    }
+}
+
+/* Drops the bookkeeping areas from the change set and adds the regions the
+   user asked for */
+void filterChanges(const char* includeRegionsStr) {
+    ignoreRegion(0x0000, 0x00ff); // ignore zp
+    ignoreRegion(0x0100, 0x01ff); // ignore stack
+
+    if (flag_ignoresidregs) { ignoreRegion(0xd400, 0xd7ff); }
+
+    if (includeRegionsStr != NULL) { includeRegions(includeRegionsStr); }
+}
+
+/* Drops RAM the tune wrote and always overwrites before reading it again,
+   and adds the zero page bytes it reads before writing, both as seen by
+   observeAccess(). I/O, the SID included, and -g regions are kept whatever
+   the tune does with them, and the driver's counter and flip-flop are left
+   alone. */
+void applyLiveness(const uint8_t* access, const uint8_t* written, uint16_t frameCounterAddress, uint16_t flipflopAddress) {
+    int dropped = 0;
+    int added = 0;
+
+    for (int i = 0; i < MEMSIZE; i++) {
+        if (isIO((ushort)i) || included_map[i] || !written[i]) { continue; }
+
+        if (memory_changes[i] && (access[i] & ACCESS_DEAD)) {
+            memory_changes[i] = 0;
+            dropped++;
+        }
+    }
+
+    for (int i = 0; i < 0x100; i++) {
+        if ((i >= frameCounterAddress && i < frameCounterAddress + 4) || i == flipflopAddress) { continue; }
+
+        if (!memory_changes[i] && written[i] && (access[i] & ACCESS_LIVE)) {
+            verbose("Live zero page byte 0x%04x\n", i);
+            memory_changes[i] = 1;
+            touchMemory(i, i);
+            added++;
+        }
+    }
+
+    printf("Liveness: %d write-before-read bytes dropped, %d live zero page bytes added\n", dropped, added);
+}
+
+int parseFrameList(const char* str, int* frames, int maxCount) {
+    int count = 0;
+    char* frameptr = (char*)str;
+
+    while (*frameptr != '\0' && count < maxCount) {
+        frames[count++] = (int)strtol(frameptr, &frameptr, 0);
+
+        if (*frameptr == ',') { frameptr++; } else { break; }
+    }
+
+    return count;
+}
+
+/* "music.diff" -> "music_100-500.diff" */
+static void deltaFilename(char* out, size_t size, const char* filename, int from, int to) {
+    const char* ext = strrchr(filename, '.');
+    const char* slash = strrchr(filename, '/');
+
+    if (ext == NULL || (slash != NULL && ext < slash)) { ext = filename + strlen(filename); }
+
+    snprintf(out, size, "%.*s_%d-%d%s", (int)(ext - filename), filename, from, to, ext);
+}
+
+/* Deltas are indexed as frame `to` of a tune key derived from `from` */
+static uint64_t deltaKey(uint64_t tuneKey, int from) {
+    return hash64(&from, sizeof(from), tuneKey);
+}
+
+static bool lookupDeltas(const int* positions, int count, const char* diffFilename, uint64_t tuneKey) {
+    uint64_t diffKeys[MAXDELTAS];
+
+    for (int i = 1; i < count; i++) {
+        if (!storeLookup(deltaKey(tuneKey, positions[i - 1]), 0, positions[i], &diffKeys[i])) { return false; }
+    }
+
+    for (int i = 1; i < count; i++) {
+        char filename[4096];
+        deltaFilename(filename, sizeof(filename), diffFilename, positions[i - 1], positions[i]);
+        storeLink(diffKeys[i], filename, (flag_overwrite != 0));
+    }
+
+    return true;
+}
+
+/* Plays through every position once, keeping a snapshot of each, and writes
+   one diff per consecutive pair with only the bytes that differ. Positions
+   may go backwards, the diff then restores the earlier state. */
+void playDeltas(const int* positions, int count, uint16_t frameCounterAddress, uint16_t frameChangedAddress,
+                const char* diffFilename, const char* includeRegionsStr, uint64_t tuneKey, bool useStore) {
+    int sorted[MAXDELTAS];
+    uint8_t* snapshots[MAXDELTAS];
+    int snapshotCount = 0;
+
+    memcpy(sorted, positions, count * sizeof(int));
+
+    for (int i = 1; i < count; i++) {
+        for (int j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+            int t = sorted[j]; sorted[j] = sorted[j - 1]; sorted[j - 1] = t;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && sorted[i] == sorted[i - 1]) { continue; }
+
+        if (playMusic(frameCounterAddress, frameChangedAddress, sorted[i]) != sorted[i]) {
+            watchdogReport();
+            printf("Couldn't reach frame %d. Exiting...\n", sorted[i]);
+            exit(1);
+        }
+
+        sorted[snapshotCount] = sorted[i];
+        snapshots[snapshotCount] = malloc(MEMSIZE);
+        memcpy(snapshots[snapshotCount], memory, MEMSIZE);
+        snapshotCount++;
+    }
+
+    for (int i = 1; i < count; i++) {
+        const uint8_t* from = NULL;
+        const uint8_t* to = NULL;
+
+        for (int s = 0; s < snapshotCount; s++) {
+            if (sorted[s] == positions[i - 1]) { from = snapshots[s]; }
+            if (sorted[s] == positions[i]) { to = snapshots[s]; }
+        }
+
+        static uint8_t differs[MEMSIZE];
+        deltaChanges(from, to, differs);
+        memcpy(memory_changes, differs, MEMSIZE);
+        touchMemory(0, MEMSIZE - 1);
+
+        /* Regions included by hand still only go in when they differ */
+        filterChanges(includeRegionsStr);
+
+        int changes = 0;
+        for (int a = 0; a < MEMSIZE; a++) {
+            memory_changes[a] &= differs[a];
+            changes += memory_changes[a];
+        }
+
+        printf("Delta %d -> %d: %d places\n", positions[i - 1], positions[i], changes);
+
+        char filename[4096];
+        deltaFilename(filename, sizeof(filename), diffFilename, positions[i - 1], positions[i]);
+
+        if (useStore) {
+            uint64_t diffKey = storeChanges(deltaKey(tuneKey, positions[i - 1]), 0, positions[i], to, memory_changes);
+            storeLink(diffKey, filename, (flag_overwrite != 0));
+        } else {
+            saveChanges(filename, (flag_overwrite != 0), to, memory_changes);
+        }
+    }
+
+    for (int s = 0; s < snapshotCount; s++) {
+        free(snapshots[s]);
+    }
+}
+
+/* Seed for tune keys covering the options that shape a diff */
+static uint64_t optionsKey(const char* includeRegionsStr) {
+    uint64_t key = hash64(&flag_ignoresidregs, sizeof(flag_ignoresidregs), HASH_INIT);
+
+    if (flag_liveness) { key = hash64(&flag_liveness, sizeof(flag_liveness), key); }
+    if (flag_baseline) { key = hash64(&flag_baseline, sizeof(flag_baseline), key); }
+
+    if (includeRegionsStr != NULL) { key = hash64(includeRegionsStr, strlen(includeRegionsStr), key); }
+
+    return key;
+}
+
+int main(int argc, char** argv) {
+    printf("SIDulator v%s - Pre-replays a sid file to the correct position and saves the diff\n", VERSION);
+
+    int c = 0;
+
+    char* sid_filename = NULL;
+    char* diff_filename = NULL;
+    char* playerprg_filename = NULL;
+    char* loadaddr_str = NULL;
+    char* framecount_str = NULL;
+    char* skipbytes_str = NULL;
+    char* flipflopaddr_str = NULL;
+    char* framecounteraddr_str = NULL;
+    char* includeregions_str = NULL;
+    char* watchhits_str = NULL;
+    char* corpus_path = NULL;
+    char* jobs_str = NULL;
+    char* store_dir = NULL;
+    char* deltas_str = NULL;
+    char* output_str = NULL;
+    char* diffaddr_str = NULL;
+    char* subtune_str = NULL;
+    char* chunklines_str = NULL;
+    char* telemetry_str = NULL;
+    char* telemetryinterval_str = NULL;
+    char* seek_str = NULL;
+    char* sidlog_str = NULL;
+    char* find_str = NULL;
+    char* findmask_str = NULL;
+    char* schedule_str = NULL;
+    char* slicecycles_str = NULL;
+    char* checkpoints_str = NULL;
+    char* tunecycles_str = NULL;
+    char* load_str = NULL;
+    char* audio_str = NULL;
+    char* audiorate_str = NULL;
+    char* audioquality_str = NULL;
+
+    do {
+        int option_index = 0;
+        c = getopt_long(argc, argv, "f:s:l:d:c:p:i:t:g:w:n:C:j:S:a:T:O:A:u:L:M:I:R:H:J:W:F:G:E:k:K:b:z:V:N:q:hroveDPZBmUX", long_options, &option_index);
+
+        if (c < 0) { break; }
+
+        switch (c) {
+            case 0:
+                /* If this option set a flag, do nothing else now. */
+                if (long_options[option_index].flag != 0) { break; }
+
+                printf("option %s", long_options[option_index].name);
+
+                if (optarg) {
+                    printf(" with arg %s\n", optarg);
+                }
+                break;
+
+            case 'v':
+                verbose("Verbose mode\n");
+                flag_verbose = 'v';
+                break;
+
+            case 'o':
+                verbose("Overwrite existing .diff-file\n");
+                flag_overwrite = 'o';
+                break;
+            
+            case 'r':
+                verbose("Ignore changes in SID registers\n");
+                flag_ignoresidregs = 'r';
+                break;
+
+            case 'e':
+                verbose("Stop when watches match\n");
+                flag_watchstop = 'e';
+                break;
+
+            case 'D':
+                verbose("Write diffs into the corpus container\n");
+                flag_corpusdiffs = 'D';
+                break;
+
+            case 'P':
+                verbose("Profile play routine\n");
+                flag_profile = 'P';
+                break;
+
+            case 'Z':
+                verbose("Trim the diff by liveness\n");
+                flag_liveness = 'Z';
+                break;
+
+            case 'B':
+                verbose("Diff against the loaded image\n");
+                flag_baseline = 'B';
+                break;
+
+            case 'm':
+                verbose("Memoise frames\n");
+                flag_memo = 'm';
+                break;
+
+            case 'X':
+                verbose("Closed-form counted loops\n");
+                flag_fastloops = 'X';
+                break;
+
+            case 'U':
+                verbose("Float audio\n");
+                flag_audiofloat = 'U';
+                break;
+
+            case 'h':
+                printHelp();
+                exit(0);
+                break;
+
+            case 'l':
+                verbose("loadaddr=`%s`\n", optarg);
+                loadaddr_str = optarg;
+                break;
 
             case 's':
                 verbose("skipbytes=`%s`\n", optarg);
@@ -376,6 +2290,145 @@ int main(int argc, char** argv) {
                 includeregions_str = optarg;
                 break;
 
+            case 'w':
+                watchAdd(optarg);
+                break;
+
+            case 'n':
+                verbose("watchhits=`%s`\n", optarg);
+                watchhits_str = optarg;
+                break;
+
+            case 'C':
+                verbose("corpus=`%s`\n", optarg);
+                corpus_path = optarg;
+                break;
+
+            case 'j':
+                verbose("jobs=`%s`\n", optarg);
+                jobs_str = optarg;
+                break;
+
+            case 'S':
+                verbose("store=`%s`\n", optarg);
+                store_dir = optarg;
+                break;
+
+            case 'a':
+                verbose("deltas=`%s`\n", optarg);
+                deltas_str = optarg;
+                break;
+
+            case 'T':
+                verbose("trace=`%s`\n", optarg);
+                trace_file = createFile(optarg, "w");
+
+                if (!trace_file) {
+                    printf("Couldn't create trace file `%s`. Exiting...\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'O':
+                verbose("output=`%s`\n", optarg);
+                output_str = optarg;
+                break;
+
+            case 'A':
+                verbose("diffaddr=`%s`\n", optarg);
+                diffaddr_str = optarg;
+                break;
+
+            case 'u':
+                verbose("subtune=`%s`\n", optarg);
+                subtune_str = optarg;
+                break;
+
+            case 'L':
+                verbose("chunklines=`%s`\n", optarg);
+                chunklines_str = optarg;
+                break;
+
+            case 'M':
+                verbose("telemetry=`%s`\n", optarg);
+                telemetry_str = optarg;
+                break;
+
+            case 'I':
+                verbose("telemetryinterval=`%s`\n", optarg);
+                telemetryinterval_str = optarg;
+                break;
+
+            case 'R':
+                verbose("rasterbudget=`%s`\n", optarg);
+                watchdog.rasterCycles = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+
+            case 'H':
+                verbose("hangcycles=`%s`\n", optarg);
+                watchdog.hangCycles = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+
+            case 'J':
+                verbose("seek=`%s`\n", optarg);
+                seek_str = optarg;
+                break;
+
+            case 'W':
+                verbose("sidlog=`%s`\n", optarg);
+                sidlog_str = optarg;
+                break;
+
+            case 'F':
+                verbose("find=`%s`\n", optarg);
+                find_str = optarg;
+                break;
+
+            case 'G':
+                verbose("findmask=`%s`\n", optarg);
+                findmask_str = optarg;
+                break;
+
+            case 'E':
+                verbose("schedule=`%s`\n", optarg);
+                schedule_str = optarg;
+                break;
+
+            case 'k':
+                verbose("slicecycles=`%s`\n", optarg);
+                slicecycles_str = optarg;
+                break;
+
+            case 'K':
+                verbose("checkpoints=`%s`\n", optarg);
+                checkpoints_str = optarg;
+                break;
+
+            case 'b':
+                verbose("tunecycles=`%s`\n", optarg);
+                tunecycles_str = optarg;
+                break;
+
+            case 'z':
+                verbose("load=`%s`\n", optarg);
+                load_str = optarg;
+                break;
+
+            case 'V':
+                verbose("audio=`%s`\n", optarg);
+                audio_str = optarg;
+                break;
+
+            case 'N':
+                verbose("audiorate=`%s`\n", optarg);
+                audiorate_str = optarg;
+                break;
+
+            case 'q':
+                verbose("audioquality=`%s`\n", optarg);
+                audioquality_str = optarg;
+                break;
+
             case '?':
                 /* getopt_long already printed an error message. */
                 break;
@@ -395,7 +2448,66 @@ int main(int argc, char** argv) {
         putchar('\n');
     }
 
-    if (sid_filename == NULL || diff_filename == NULL || 
+    if (telemetry_str != NULL) {
+        telemetryOpen(telemetry_str, telemetryinterval_str != NULL ? strtod(telemetryinterval_str, NULL) : 1.0);
+    }
+
+    if (corpus_path != NULL) {
+        if (diff_filename == NULL || framecount_str == NULL) {
+            printf("Mandatory parameter(s) missing!\n");
+            exit(1);
+        }
+
+        corpusjob_t job;
+        memset(&job, 0, sizeof(job));
+
+        job.path = corpus_path;
+        job.output = diff_filename;
+        job.overwrite = (flag_overwrite != 0);
+        job.diffs = (flag_corpusdiffs != 0);
+        job.includeRegions = includeregions_str;
+        job.store = store_dir;
+        job.optionsKey = optionsKey(includeregions_str);
+        job.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (jobs_str != NULL) { job.workers = (int)strtol(jobs_str, NULL, 0); }
+        if (job.workers < 1) { job.workers = 1; }
+
+        job.tuneCycles = tunecycles_str != NULL ? strtoull(tunecycles_str, NULL, 0) : 0;
+
+        /* -c takes a comma separated list of fixed times in corpus mode */
+        int frames[MAXCORPUSFRAMES];
+        int count = parseFrameList(framecount_str, frames, MAXCORPUSFRAMES);
+
+        for (int i = 0; i < count; i++) {
+            if (job.frameCount == 0 || frames[i] > job.frames[job.frameCount - 1]) {
+                job.frames[job.frameCount++] = frames[i];
+            }
+        }
+
+        exit(runCorpus(&job));
+    }
+
+    int deltaPositions[MAXDELTAS];
+    int deltaCount = 0;
+
+    if (deltas_str != NULL) {
+        deltaCount = parseFrameList(deltas_str, deltaPositions, MAXDELTAS);
+
+        if (deltaCount < 2) {
+            printf("--deltas needs at least two frames. Exiting...\n");
+            exit(1);
+        }
+    }
+
+    /* Both play through loops of their own that never replay */
+    if (flag_memo && (deltaCount > 0 || find_str != NULL)) {
+        printf("--memoise can't be combined with --deltas or --find. Exiting...\n");
+        exit(1);
+    }
+
+    /* Finding a frame doesn't write a diff, and scheduled seeks only do if asked to */
+    if (sid_filename == NULL || (diff_filename == NULL && find_str == NULL && schedule_str == NULL && load_str == NULL) ||
         loadaddr_str == NULL || playerprg_filename == NULL ||
         flipflopaddr_str == NULL || framecounteraddr_str == NULL) {
 
@@ -413,50 +2525,296 @@ int main(int argc, char** argv) {
     if (framecount_str != NULL) { frameCount = (int)strtol(framecount_str, NULL, 0); }
 
 
-    clearMemory(0);
-    loadFile(sid_filename, loadAddress, skipBytes);
-    uint16_t playerStartAddress = loadPrg(playerprg_filename);
-
     int flipflopAddress = 0;
     if (flipflopaddr_str != NULL) { flipflopAddress = (int)strtol(flipflopaddr_str, NULL, 0); }
 
     int frameCounterAddress = 0;
     if (framecounteraddr_str != NULL) { frameCounterAddress = (int)strtol(framecounteraddr_str, NULL, 0); }
 
-    playMusic(playerStartAddress, frameCounterAddress, flipflopAddress, frameCount);
-//    printMemory();
-    ignoreRegion(0x0000, 0x00ff); // ignore zp
-    ignoreRegion(0x0100, 0x01ff); // ignore stack
+    exportjob_t export;
+    memset(&export, 0, sizeof(export));
 
-    if (flag_ignoresidregs) { ignoreRegion(0xd400, 0xd7ff); }
+    psid_t psid;
+
+    export.format = output_str != NULL ? exportFormat(output_str) : EXPORT_DIFF;
+    export.address = diffaddr_str != NULL ? (int)strtol(diffaddr_str, NULL, 0) : -1;
+    export.chunkLines = chunklines_str != NULL ? (int)strtol(chunklines_str, NULL, 0) : 16;
 
-    if (includeregions_str != NULL) {
-        verbose("Include regions: `%s`\n", includeregions_str);
-        int maxlen = strlen(includeregions_str);
-        char *maxlenptr = includeregions_str + maxlen;
+    if (export.format != EXPORT_DIFF && deltaCount > 0) {
+        printf("--output works on a single diff, not with --deltas. Exiting...\n");
+        exit(1);
+    }
+
+    if (export.format == EXPORT_PSID) {
+        /* player.prg picks the subtune itself, so only the user knows which one was played */
+        if (subtune_str == NULL) {
+            printf("--output psid needs --subtune, the subtune player.prg plays. Exiting...\n");
+            exit(1);
+        }
 
-        char* tokens = ",\0";
-        char* chrptr = NULL;
+        loadPsid(sid_filename, &psid);
 
-        chrptr = strtok(includeregions_str, tokens);
+        export.psid = &psid;
+        export.subtune = (int)strtol(subtune_str, NULL, 0);
 
-        while (chrptr != NULL) {
-            char* dashptr = strstr(chrptr, "-");
-            if (dashptr == NULL) {
-                int addr = (int)strtol(chrptr, NULL, 0);
-                includeRegion(addr, addr);
-            } else {
-                int addr_s = (int)strtol(chrptr, NULL, 0);
-                int addr_e = (int)strtol(dashptr + 1, NULL, 0);
-                includeRegion(addr_s, addr_e);
-            }
+        /* The init stub passes it in A whether the header lists it or not */
+        if (export.subtune < 1 || export.subtune > 256) {
+            printf("Subtune %d out of range. Exiting...\n", export.subtune);
+            exit(1);
+        }
+    }
+
+    uint64_t tuneKey = 0;
+
+    /* The store only holds bare diffs */
+    if (store_dir != NULL && export.format == EXPORT_DIFF) {
+        storeOpen(store_dir);
+
+        /* The subtune is whatever player.prg selects, so it's part of the tune key */
+        int params[] = { loadAddress, skipBytes, flipflopAddress, frameCounterAddress };
+
+        tuneKey = hashFile(sid_filename, optionsKey(includeregions_str));
+        tuneKey = hashFile(playerprg_filename, tuneKey);
+        tuneKey = hash64(params, sizeof(params), tuneKey);
+
+        uint64_t diffKey = 0;
+
+        if (deltaCount > 0 && lookupDeltas(deltaPositions, deltaCount, diff_filename, tuneKey)) {
+            printf("Deltas found in store, nothing to emulate\n");
+            exit(0);
+        }
+
+        /* With -J the diff is the one of the last position sought */
+        int storeFrame = frameCount;
+
+        if (seek_str != NULL) {
+            int seeks[MAXDELTAS];
+            int seekCount = parseFrameList(seek_str, seeks, MAXDELTAS);
+
+            if (seekCount > 0) { storeFrame = seeks[seekCount - 1]; }
+        }
+
+        if (deltaCount == 0 && watchCount() == 0 && storeLookup(tuneKey, 0, storeFrame, &diffKey)) {
+            printf("Diff %016llx found in store, nothing to emulate\n", (unsigned long long)diffKey);
+            storeLink(diffKey, diff_filename, (flag_overwrite != 0));
+            exit(0);
+        }
+    }
+
+    clearMemory(0);
+    export.tuneStart = (uint16_t)loadAddress;
+    export.tuneSize = (uint32_t)loadFile(sid_filename, loadAddress, skipBytes);
+
+    if (export.format == EXPORT_PSID && (export.tuneStart != psid.loadAddress || export.tuneSize != psid.dataSize)) {
+        printf("--loadaddr and --skipbytes don't match the PSID header ($%04x, %u bytes). Exiting...\n",
+               psid.loadAddress, (unsigned)psid.dataSize);
+        exit(1);
+    }
+    uint16_t playerStartAddress = loadPrg(playerprg_filename);
+
+    if (schedule_str != NULL || load_str != NULL) {
+        static template_t tune;
+        templateCapture(&tune, playerStartAddress);
+
+        schedule_t schedule;
+        memset(&schedule, 0, sizeof(schedule));
+
+        schedule.requests = schedule_str;
+        schedule.diffFilename = diff_filename;
+        schedule.includeRegions = includeregions_str;
+        schedule.overwrite = (flag_overwrite != 0);
+        schedule.tune = &tune;
+        schedule.frameCounter = (uint16_t)frameCounterAddress;
+        schedule.flipflop = (uint16_t)flipflopAddress;
+        schedule.sliceCycles = slicecycles_str != NULL ? strtoull(slicecycles_str, NULL, 0) : SLICECYCLES;
+        schedule.checkpoints = checkpoints_str != NULL ? (int)strtol(checkpoints_str, NULL, 0) : 0;
+
+        if (schedule.checkpoints < 0) {
+            printf("Bad checkpoint count `%s`. Exiting...\n", checkpoints_str);
+            exit(1);
+        }
+
+        /* Under load the request file, if any, is the recorded mix to replay */
+        if (load_str != NULL) { exit(runLoad(&schedule, load_str)); }
+
+        exit(runSchedule(&schedule));
+    }
+
+    int watchHits = 1;
+    if (watchhits_str != NULL) { watchHits = (int)strtol(watchhits_str, NULL, 0); }
+
+    if (watchCount() > 0) { watchBegin(watchHits); }
+
+    /* Only the placed outputs and liveness look at what the tune wrote */
+    bool keepWrites = export.format != EXPORT_DIFF || flag_liveness;
+
+    /* With a baseline the change set is the end-state delta against the
+       loaded image, writes are only tracked when something above needs them */
+    static uint8_t baseline[MEMSIZE];
+
+    if (flag_baseline) {
+        memcpy(baseline, memory, sizeof(baseline));
+        if (!keepWrites) { trackChanges(false); }
+    }
+
+    startMusic(playerStartAddress);
+
+    int framesPlayed = 0;
+
+    if (audio_str != NULL) {
+        audioOpen(audio_str, (flag_overwrite != 0), audiorate_str != NULL ? (uint32_t)strtoul(audiorate_str, NULL, 0) : AUDIORATE,
+                  audioquality_str != NULL ? (int)strtol(audioquality_str, NULL, 0) : AUDIOQUALITY, (flag_audiofloat != 0));
+    }
+
+    if (sidlog_str != NULL || audio_str != NULL) {
+        eventsOpen(sidlog_str, (flag_overwrite != 0));
+        for (int i = SIDBASE; i < 0xd800; i++) { write_trap[i] |= TRAP_EVENTS; }
+    }
+
+    if (find_str != NULL) {
+        /* The tune image unless told otherwise, it holds the player's variables */
+        char mask[32];
+        snprintf(mask, sizeof(mask), "0x%04x-0x%04x", export.tuneStart, export.tuneStart + export.tuneSize - 1);
+
+        findBegin(find_str, findmask_str != NULL ? findmask_str : mask, frameCounterAddress);
+        for (int i = 0; i < MEMSIZE; i++) { write_trap[i] |= TRAP_FIND; }
+
+        static uint8_t image[MEMSIZE];
+        memcpy(image, memory, sizeof(image));
+
+        trackChanges(false);
+        int maxFrames = frameCount > 0 ? frameCount : FINDFRAMES;
+        framesPlayed = playMusic(frameCounterAddress, flipflopAddress, maxFrames);
+
+        /* A fingerprint only suggests a loop, the replay decides */
+        int first, repeat;
+        while (framesPlayed >= 0 && findLoop(&first, &repeat) &&
+               !replayLoop(image, playerStartAddress, frameCounterAddress, flipflopAddress, first, repeat)) {
+            verbose("Frame %d only shares a fingerprint with frame %d, searching on\n", repeat, first);
+
+            if (findLoopRejected(repeat)) { break; }
+            framesPlayed = playMusic(frameCounterAddress, flipflopAddress, maxFrames);
+        }
+
+        for (int i = 0; i < MEMSIZE; i++) { write_trap[i] &= ~TRAP_FIND; }
+        telemetryClose(current_frame);
+        eventsClose();
+
+        if (framesPlayed < 0) {
+            watchdogReport();
+            printf("Tune hung at frame %d, searched up to there\n", current_frame);
+        }
+
+        findReport(framesPlayed);
+        exit(0);
+    }
+
+    if (deltaCount > 0) {
+        /* Deltas are taken from snapshots, per-write tracking isn't needed */
+        trackChanges(false);
+        playDeltas(deltaPositions, deltaCount, frameCounterAddress, flipflopAddress, diff_filename,
+                   includeregions_str, tuneKey, store_dir != NULL);
+        telemetryClose(current_frame);
+        eventsClose();
+        printProfile();
+        exit(0);
+    }
+
+    if (seek_str != NULL) { journalBegin(); }
+
+    /* Replayed frames skip the write traps that watches and the journal need */
+    if (flag_memo && (seek_str != NULL || watchCount() > 0 || flag_profile || trace_file != NULL ||
+                      sidlog_str != NULL || audio_str != NULL)) {
+        printf("Memoisation can't be combined with seeking, watches, profiling, tracing, a SID log or audio. Ignored.\n");
+    } else if (flag_memo && !memoBegin(frameCounterAddress, flipflopAddress, playerStartAddress + PLAYERFRAMESTEP)) {
+        printf("Memoisation needs a driver stepping the frame counter and flip-flop like player.asm. Ignored.\n");
+    }
+
+    framesPlayed = playMusic(frameCounterAddress, flipflopAddress, frameCount);
+
+    /* -J visits more positions in order, the outputs are taken at the last one */
+    if (seek_str != NULL && framesPlayed >= 0) {
+        int seeks[MAXDELTAS];
+        int seekCount = parseFrameList(seek_str, seeks, MAXDELTAS);
+
+        for (int i = 0; i < seekCount && framesPlayed >= 0; i++) {
+            clock_t started = clock();
+            framesPlayed = seekFrame(frameCounterAddress, flipflopAddress, seeks[i]);
 
-            chrptr = strtok(NULL, tokens);
+            verbose("Seek to frame %d: %.3f ms\n", seeks[i], 1000.0 * (clock() - started) / CLOCKS_PER_SEC);
+
+            if (framesPlayed != seeks[i] && framesPlayed >= 0) {
+                printf("Couldn't seek to frame %d. Exiting...\n", seeks[i]);
+                exit(1);
+            }
         }
     }
 
+    telemetryClose(current_frame);
+    eventsClose();
+    memoReport();
+    memoEnd();
+
+    if (flag_fastloops) {
+        verbose("Fast loops: %llu run in closed form, %llu instructions\n",
+                (unsigned long long)fastloop_runs, (unsigned long long)fastloop_instructions);
+    }
+
+    if (framesPlayed < 0) {
+        watchdogReport();
+        printf("Tune hung. Exiting...\n");
+        exit(1);
+    }
+
+    if (play_stats.overruns > 0) {
+        printf("Raster budget of %u cycles exceeded in %u frames, first in frame %d, longest %u cycles\n",
+               watchdog.rasterCycles, play_stats.overruns, play_stats.firstOverrun, play_stats.maxFrameCycles);
+    }
+
+    if (watchCount() > 0) {
+        watchReport();
+
+        if (flag_watchstop) { printf("Stopped at frame %d\n", framesPlayed); }
+    }
+
+//    printMemory();
+    printProfile();
+
+    /* Everything the tune wrote, for the free-space check of the outputs */
+    static uint8_t used[MEMSIZE];
+
+    if (keepWrites) {
+        memcpy(used, memory_changes, sizeof(used));
+        export.used = used;
+    }
+
+    /* Scratch memory the tune wrote and restored stays in used above */
+    if (flag_baseline) {
+        int count = deltaChanges(baseline, memory, memory_changes);
+        verbose("%d bytes differ from the loaded image (%s)\n", count, deltaImplementation());
+    }
+
+    static uint8_t access[MEMSIZE];
+
+    if (export.format == EXPORT_CHUNKED || flag_liveness) {
+        observeAccess(frameCounterAddress, flipflopAddress, OBSERVEFRAMES, access);
+        export.access = access;
+    }
+
+    filterChanges(includeregions_str);
+
+    if (flag_liveness) { applyLiveness(access, used, frameCounterAddress, flipflopAddress); }
+
     printChanges();
-    saveChanges(diff_filename, (flag_overwrite != 0));
+
+    if (export.format != EXPORT_DIFF) {
+        exportDiff(diff_filename, (flag_overwrite != 0), &export, memory, memory_changes);
+    } else if (store_dir != NULL) {
+        uint64_t diffKey = storeChanges(tuneKey, 0, framesPlayed, memory, memory_changes);
+        storeLink(diffKey, diff_filename, (flag_overwrite != 0));
+    } else {
+        saveChanges(diff_filename, (flag_overwrite != 0), memory, memory_changes);
+    }
 
     exit(0);
 }
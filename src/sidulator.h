@@ -0,0 +1,102 @@
+#ifndef SIDULATOR_H
+#define SIDULATOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MEMSIZE 65536
+
+#define SIDBASE 0xd400
+
+/* Watchdog defaults: a PAL frame of raster time, and the cycles a single
+   frame may take before the tune is considered hung (about a second). The
+   first frame runs init, which may decrunch or build tables for much longer. */
+#define RASTERCYCLES 19656
+#define HANGCYCLES 1000000
+#define INITCYCLES 100000000
+
+/* Emulated C64 address space, owned by sidulator.c */
+extern uint8_t memory[MEMSIZE];
+extern uint8_t memory_changes[MEMSIZE];
+
+typedef struct {
+    uint64_t cycles;            /* cycles of all completed frames */
+    uint64_t instructions;
+    uint32_t frameCycles;       /* cycles spent in the current frame so far */
+    uint32_t maxFrameCycles;    /* longest completed frame, player overhead included */
+    uint32_t overruns;          /* frames over the raster budget, the init frame not counted */
+    int firstOverrun;           /* frame number of the first one */
+} playstats_t;
+
+extern playstats_t play_stats;
+
+/* When set, the cycles of every completed frame are added to it, for a supervisor to read */
+extern uint64_t* cycle_meter;
+
+typedef struct {
+    uint32_t rasterCycles;      /* frames longer than this are counted as overruns */
+    uint32_t hangCycles;        /* a frame longer than this stops playMusic() */
+    uint32_t initCycles;        /* the same for the first frame, which includes init */
+} watchdog_t;
+
+extern watchdog_t watchdog;
+
+/* observeAccess() bits per address */
+#define ACCESS_READ 1           /* read at some point */
+#define ACCESS_LIVE 2           /* read before written */
+#define ACCESS_DEAD 4           /* written before read */
+
+/* A tune loaded once and restarted many times. Writes mark their page
+   dirty, and a restart copies back only the dirty pages of the image. */
+typedef struct {
+    uint8_t memory[MEMSIZE];
+    uint16_t start;             /* player start address */
+} template_t;
+
+/* Registers and statistics at a frame boundary */
+typedef struct {
+    int frame;
+    uint16_t pc;
+    uint8_t a, x, y, sp, status;
+    playstats_t stats;
+} cpustate_t;
+
+/* A suspended machine, see contextSave() */
+typedef struct {
+    uint8_t memory[MEMSIZE];
+    uint8_t changes[MEMSIZE];
+    cpustate_t state;
+    bool saved;                 /* false until the first save, which copies every page */
+} context_t;
+
+int verbose(const char * restrict format, ...);
+
+void clearMemory(uint8_t value);
+void touchMemory(uint32_t startAddr, uint32_t endAddr);    /* for writes outside write6502() */
+void templateCapture(template_t* t, uint16_t playerStartAddress);
+void templateReset(const template_t* t);
+void contextSave(context_t* context);
+void contextLoad(const context_t* context);
+void trackChanges(bool enabled);
+bool trackingChanges();
+void startMusic(uint16_t playerStartAddress);
+int playMusic(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int maxFrames);
+void watchdogReport();
+
+void journalBegin();
+void journalEnd();
+int seekFrame(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int frame);
+
+bool memoBegin(uint16_t frameCounterAddress, uint16_t frameChangedAddress, uint16_t frameStepAddress);
+void memoReport();
+void memoEnd();
+void observeAccess(uint16_t frameCounterAddress, uint16_t frameChangedAddress, int frames, uint8_t* access);
+
+void ignoreRegion(uint16_t startAddr, uint16_t endAddr);
+void filterChanges(const char* includeRegionsStr);
+void writeDiff(FILE* fp, const uint8_t* values, const uint8_t* changes);
+void writeStandaloneDiff(FILE* fp, const uint8_t* values, const uint8_t* changes);
+FILE* createFile(const char* filename, const char* mode);
+
+#endif
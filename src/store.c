@@ -0,0 +1,272 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "hash.h"
+
+#define MAXPATH 4096
+
+static char store_dir[MAXPATH];
+
+static void makeDirectory(const char* path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        printf("Couldn't create store directory `%s`. Exiting...\n", path);
+        exit(1);
+    }
+}
+
+static void objectPath(char* path, size_t size, uint64_t diffKey) {
+    snprintf(path, size, "%s/objects/%02x/%016llx.diff", store_dir,
+             (unsigned)(diffKey >> 56), (unsigned long long)diffKey);
+}
+
+static void indexPath(char* path, size_t size, uint64_t tuneKey) {
+    snprintf(path, size, "%s/index/%016llx", store_dir, (unsigned long long)tuneKey);
+}
+
+void storeOpen(const char* dir) {
+    char path[MAXPATH];
+
+    snprintf(store_dir, sizeof(store_dir), "%s", dir);
+    makeDirectory(store_dir);
+
+    snprintf(path, sizeof(path), "%s/objects", store_dir);
+    makeDirectory(path);
+
+    snprintf(path, sizeof(path), "%s/index", store_dir);
+    makeDirectory(path);
+
+    verbose("Diff store: `%s`\n", store_dir);
+}
+
+/* The index line for (subtune, frame), false if there is none or its
+   object is gone. Lines from corpus runs also carry what index.tsv shows. */
+static bool lookupEntry(uint64_t tuneKey, int subtune, int frame, storerun_t* run, bool* complete) {
+    char path[MAXPATH];
+    indexPath(path, sizeof(path), tuneKey);
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) { return false; }
+
+    char line[256];
+    bool found = false;
+
+    /* Later lines win, so a re-run can replace an entry */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int s = 0, f = 0;
+        unsigned long long key = 0, fingerprint = 0;
+        unsigned int cycles = 0;
+
+        int fields = sscanf(line, "%d %d %llx %llx %u", &s, &f, &key, &fingerprint, &cycles);
+
+        if (fields >= 3 && s == subtune && f == frame) {
+            run->diffKey = key;
+            run->fingerprint = fingerprint;
+            run->maxFrameCycles = cycles;
+            *complete = fields == 5;
+            found = true;
+        }
+    }
+
+    fclose(fp);
+
+    if (!found) { return false; }
+
+    /* An index entry without its object is stale */
+    struct stat st;
+    objectPath(path, sizeof(path), run->diffKey);
+    if (stat(path, &st) != 0) { return false; }
+
+    run->diffSize = (uint32_t)st.st_size;
+    return true;
+}
+
+bool storeLookup(uint64_t tuneKey, int subtune, int frame, uint64_t* diffKey) {
+    storerun_t run;
+    bool complete = false;
+
+    if (!lookupEntry(tuneKey, subtune, frame, &run, &complete)) { return false; }
+
+    *diffKey = run.diffKey;
+    return true;
+}
+
+bool storeLookupRun(uint64_t tuneKey, int subtune, int frame, storerun_t* run) {
+    bool complete = false;
+
+    return lookupEntry(tuneKey, subtune, frame, run, &complete) && complete;
+}
+
+/* True if the object at path holds exactly these bytes */
+static bool sameObject(const char* path, const void* diff, size_t size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) { return false; }
+
+    struct stat st;
+    bool same = fstat(fileno(fp), &st) == 0 && (size_t)st.st_size == size;
+
+    const uint8_t* expected = diff;
+    uint8_t buffer[8192];
+    size_t offset = 0;
+    size_t n;
+
+    while (same && (n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        same = offset + n <= size && memcmp(buffer, expected + offset, n) == 0;
+        offset += n;
+    }
+
+    fclose(fp);
+
+    return same && offset == size;
+}
+
+/* Writes the object unless it's already there, returns its key */
+static uint64_t putObject(const void* diff, size_t size) {
+    uint64_t diffKey = hash64(diff, size, HASH_INIT);
+
+    char path[MAXPATH];
+    objectPath(path, sizeof(path), diffKey);
+
+    /* A different object under the same hash moves this one to the next free key */
+    while (access(path, F_OK) == 0 && !sameObject(path, diff, size)) {
+        verbose("Diff %016llx collides with a different object in store\n", (unsigned long long)diffKey);
+        objectPath(path, sizeof(path), ++diffKey);
+    }
+
+    if (access(path, F_OK) != 0) {
+        char dir[MAXPATH];
+        snprintf(dir, sizeof(dir), "%s/objects/%02x", store_dir, (unsigned)(diffKey >> 56));
+        makeDirectory(dir);
+
+        /* Write to a private name and rename, so readers never see half an object */
+        char temp[MAXPATH];
+        snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+
+        FILE* fp = fopen(temp, "wb");
+
+        if (!fp || fwrite(diff, 1, size, fp) != size || fclose(fp) != 0) {
+            printf("Couldn't write store object `%s`. Exiting...\n", temp);
+            exit(1);
+        }
+
+        rename(temp, path);
+    } else {
+        verbose("Diff %016llx already in store\n", (unsigned long long)diffKey);
+    }
+
+    return diffKey;
+}
+
+static void appendIndex(uint64_t tuneKey, const char* line) {
+    char path[MAXPATH];
+    indexPath(path, sizeof(path), tuneKey);
+
+    FILE* fp = fopen(path, "a");
+
+    if (!fp) {
+        printf("Couldn't update store index `%s`. Exiting...\n", path);
+        exit(1);
+    }
+
+    fputs(line, fp);
+    fclose(fp);
+}
+
+uint64_t storePut(uint64_t tuneKey, int subtune, int frame, const void* diff, size_t size) {
+    uint64_t diffKey = putObject(diff, size);
+
+    char line[128];
+    snprintf(line, sizeof(line), "%d %d %016llx\n", subtune, frame, (unsigned long long)diffKey);
+    appendIndex(tuneKey, line);
+
+    return diffKey;
+}
+
+uint64_t storePutRun(uint64_t tuneKey, int subtune, int frame, const void* diff, size_t size,
+                     uint64_t fingerprint, uint32_t maxFrameCycles) {
+    uint64_t diffKey = putObject(diff, size);
+
+    char line[128];
+    snprintf(line, sizeof(line), "%d %d %016llx %016llx %u\n", subtune, frame, (unsigned long long)diffKey,
+             (unsigned long long)fingerprint, maxFrameCycles);
+    appendIndex(tuneKey, line);
+
+    return diffKey;
+}
+
+static void copyFile(const char* from, const char* to) {
+    FILE* in = fopen(from, "rb");
+    FILE* out = fopen(to, "wb");
+
+    if (!in || !out) {
+        printf("Couldn't create diff file `%s`. Exiting...\n", to);
+        exit(1);
+    }
+
+    char buffer[8192];
+    size_t n;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, n, out);
+    }
+
+    fclose(in);
+    fclose(out);
+}
+
+void storeLink(uint64_t diffKey, const char* filename, bool overwrite) {
+    if (access(filename, F_OK) == 0) {
+        if (!overwrite) {
+            printf("Diff file `%s` already exists. Exiting...\n", filename);
+            exit(1);
+        }
+
+        unlink(filename);
+    }
+
+    char path[MAXPATH];
+    objectPath(path, sizeof(path), diffKey);
+
+    /* Hard links can't cross file systems, fall back to a copy there */
+    if (link(path, filename) != 0) { copyFile(path, filename); }
+}
+
+uint64_t hashFile(const char* filename, uint64_t seed) {
+    FILE* fp = fopen(filename, "rb");
+
+    if (!fp) {
+        printf("Couldn't open file `%s`. Exiting...\n", filename);
+        exit(1);
+    }
+
+    uint8_t buffer[8192];
+    size_t n;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        seed = hash64(buffer, n, seed);
+    }
+
+    fclose(fp);
+
+    return seed;
+}
+
+uint64_t storeChanges(uint64_t tuneKey, int subtune, int frame, const uint8_t* values, const uint8_t* changes) {
+    char* diff = NULL;
+    size_t diffSize = 0;
+
+    FILE* mem = open_memstream(&diff, &diffSize);
+    writeDiff(mem, values, changes);
+    fclose(mem);
+
+    uint64_t diffKey = storePut(tuneKey, subtune, frame, diff, diffSize);
+    free(diff);
+
+    return diffKey;
+}
@@ -0,0 +1,38 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "sidulator.h"
+
+#include <stddef.h>
+
+/*
+ * Content-addressed diff store. Every distinct diff is kept once, as
+ * objects/<hh>/<hash>.diff, where the hash is taken over the diff routine.
+ * The routine lists the change set in a canonical order (by value, then
+ * address), so equal (address, value) sets always share one object.
+ * index/<tunekey> maps (subtune, frame) of one tune to the object, and
+ * output files are hard links to the objects, so every output writer
+ * replaces an existing file through createFile() instead of truncating it.
+ * An object is only reused when its bytes match, not just its hash.
+ * Corpus runs also keep their fingerprint and longest frame in the index,
+ * so a tune whose runs are all there doesn't need a worker.
+ */
+typedef struct {
+    uint64_t diffKey;
+    uint32_t diffSize;
+    uint64_t fingerprint;
+    uint32_t maxFrameCycles;
+} storerun_t;
+
+void storeOpen(const char* dir);
+bool storeLookup(uint64_t tuneKey, int subtune, int frame, uint64_t* diffKey);
+bool storeLookupRun(uint64_t tuneKey, int subtune, int frame, storerun_t* run);
+uint64_t storePut(uint64_t tuneKey, int subtune, int frame, const void* diff, size_t size);
+uint64_t storePutRun(uint64_t tuneKey, int subtune, int frame, const void* diff, size_t size,
+                     uint64_t fingerprint, uint32_t maxFrameCycles);
+uint64_t storeChanges(uint64_t tuneKey, int subtune, int frame, const uint8_t* values, const uint8_t* changes);
+void storeLink(uint64_t diffKey, const char* filename, bool overwrite);
+
+uint64_t hashFile(const char* filename, uint64_t seed);
+
+#endif
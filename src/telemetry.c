@@ -0,0 +1,172 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "telemetry.h"
+
+#define MAXPATH 4096
+
+bool telemetry_enabled = false;
+
+static FILE* telemetry_file = NULL;        /* JSON lines */
+static char prom_path[MAXPATH];            /* Prometheus textfile, when set */
+static double telemetry_interval = 1.0;
+
+static double start_time = 0;
+static double last_time = 0;
+static int last_frame = 0;
+static int last_results = 0;
+static uint64_t last_instructions = 0;
+static uint64_t last_cycles = 0;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long residentKilobytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+void telemetryOpen(const char* target, double interval) {
+    if (strncmp(target, "prom:", 5) == 0) {
+        snprintf(prom_path, sizeof(prom_path), "%s", target + 5);
+    } else if (strncmp(target, "fd:", 3) == 0) {
+        telemetry_file = fdopen((int)strtol(target + 3, NULL, 0), "w");
+    } else {
+        telemetry_file = fopen(target, "a");
+    }
+
+    if (prom_path[0] == '\0' && telemetry_file == NULL) {
+        printf("Couldn't open telemetry target `%s`. Exiting...\n", target);
+        exit(1);
+    }
+
+    /* Samples are written whole, one write per interval */
+    if (telemetry_file != NULL) { setvbuf(telemetry_file, NULL, _IOFBF, 1 << 16); }
+
+    telemetry_interval = interval > 0 ? interval : 1.0;
+    telemetry_enabled = true;
+    start_time = last_time = now();
+}
+
+typedef struct {
+    const char* name;
+    const char* help;
+    double value;
+} metric_t;
+
+static void emit(const metric_t* metrics, int count) {
+    if (telemetry_file != NULL) {
+        fprintf(telemetry_file, "{");
+
+        for (int i = 0; i < count; i++) {
+            fprintf(telemetry_file, "%s\"%s\":%.15g", i ? "," : "", metrics[i].name, metrics[i].value);
+        }
+
+        fprintf(telemetry_file, "}\n");
+        fflush(telemetry_file);
+    }
+
+    if (prom_path[0] != '\0') {
+        char temp[MAXPATH + 8];
+        snprintf(temp, sizeof(temp), "%s.tmp", prom_path);
+
+        FILE* fp = fopen(temp, "w");
+        if (fp == NULL) { return; }
+
+        for (int i = 0; i < count; i++) {
+            fprintf(fp, "# HELP sidulator_%s %s\n# TYPE sidulator_%s gauge\nsidulator_%s %.15g\n",
+                    metrics[i].name, metrics[i].help, metrics[i].name, metrics[i].name, metrics[i].value);
+        }
+
+        fclose(fp);
+        rename(temp, prom_path);
+    }
+}
+
+static void sample(int frame, double t) {
+    double elapsed = t - last_time;
+    if (elapsed <= 0) { elapsed = 1e-9; }
+
+    uint64_t cycles = play_stats.cycles;
+    int frames = frame - last_frame;
+
+    /* Without tracking (--deltas, --find) nothing marks changes */
+    bool tracked = trackingChanges();
+    int changed = 0;
+
+    if (tracked) {
+        for (int i = 0; i < MEMSIZE; i++) { changed += memory_changes[i] != 0; }
+    }
+
+    metric_t metrics[] = {
+        { "seconds", "Wall time since start", t - start_time },
+        { "frame", "Frames played", frame },
+        { "frames_per_second", "Frames played per second since the last sample", frames / elapsed },
+        { "mips", "Emulated millions of instructions per second since the last sample",
+          (play_stats.instructions - last_instructions) / elapsed / 1e6 },
+        { "cycles_per_frame", "Average cycles per frame since the last sample",
+          frames > 0 ? (double)(cycles - last_cycles) / frames : 0 },
+        { "max_frame_cycles", "Longest frame so far in cycles", play_stats.maxFrameCycles },
+        { "max_resident_kilobytes", "Peak resident set size", residentKilobytes() },
+        { "changed_bytes", "Bytes marked as changed so far, left out when changes aren't tracked", changed },
+    };
+
+    emit(metrics, sizeof(metrics) / sizeof(metrics[0]) - (tracked ? 0 : 1));
+
+    last_time = t;
+    last_frame = frame;
+    last_instructions = play_stats.instructions;
+    last_cycles = cycles;
+}
+
+/* Called from playMusic() every TELEMETRYFRAMES frames */
+void telemetryFrame(int frame) {
+    double t = now();
+
+    if (t - last_time >= telemetry_interval) { sample(frame, t); }
+}
+
+/* Progress of a corpus run, from the parent process */
+void telemetryCorpus(int started, int total, int results, bool force) {
+    double t = now();
+
+    if (!force && t - last_time < telemetry_interval) { return; }
+
+    metric_t metrics[] = {
+        { "seconds", "Wall time since start", t - start_time },
+        { "corpus_tunes", "SID files in the corpus", total },
+        { "corpus_tunes_started", "SID files handed to workers", started < total ? started : total },
+        { "corpus_results", "Results collected", results },
+        { "corpus_results_per_second", "Results collected per second since the last sample",
+          (results - last_results) / (t > last_time ? t - last_time : 1e-9) },
+        { "max_resident_kilobytes", "Peak resident set size of the parent", residentKilobytes() },
+    };
+
+    emit(metrics, sizeof(metrics) / sizeof(metrics[0]));
+
+    last_time = t;
+    last_results = results;
+}
+
+/* Final sample, taken regardless of the interval */
+void telemetryClose(int frame) {
+    if (!telemetry_enabled) { return; }
+
+    sample(frame, now());
+
+    if (telemetry_file != NULL) { fclose(telemetry_file); }
+
+    telemetry_file = NULL;
+    telemetry_enabled = false;
+}
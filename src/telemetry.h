@@ -0,0 +1,22 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "sidulator.h"
+
+/*
+ * Machine-readable progress for schedulers. playMusic() offers a sample
+ * every TELEMETRYFRAMES frames, and one is taken at most once per
+ * interval. Samples go out as JSON lines to a file or file descriptor, or
+ * as a Prometheus textfile that is replaced on every sample. The target is
+ * `fd:<n>`, `prom:<path>` or a plain path for JSON lines.
+ */
+#define TELEMETRYFRAMES 64
+
+extern bool telemetry_enabled;
+
+void telemetryOpen(const char* target, double interval);
+void telemetryFrame(int frame);
+void telemetryCorpus(int started, int total, int results, bool force);
+void telemetryClose(int frame);
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "watch.h"
+
+#define MAXCODE 128
+#define MAXSTACK 32
+
+enum {
+    OP_CONST, OP_MEM,
+    OP_NOT, OP_INV, OP_NEG,
+    OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+};
+
+typedef struct {
+    uint8_t op;
+    int32_t arg;
+} watchop_t;
+
+typedef struct {
+    const char* text;
+    watchop_t code[MAXCODE];
+    int codelen;
+    bool state;
+    int hits[MAXWATCHHITS];
+    int hitcount;
+} watch_t;
+
+uint16_t watch_map[MEMSIZE];
+
+static watch_t watches[MAXWATCHES];
+static int watch_count = 0;
+static int watch_maxhits = 1;
+static int watch_frame = 0;
+
+/* Recursive descent compiler producing postfix code, C operator precedence */
+
+static const char* src = NULL;
+static watch_t* target = NULL;
+
+static void parseError(const char* message) {
+    printf("Watch expression `%s`: %s at `%s`. Exiting...\n", target->text, message, src);
+    exit(1);
+}
+
+static void skipSpace() {
+    while (isspace((unsigned char)*src)) { src++; }
+}
+
+static bool accept(const char* token) {
+    skipSpace();
+    size_t len = strlen(token);
+
+    if (strncmp(src, token, len) != 0) { return false; }
+
+    /* don't take `&` from `&&` or `<` from `<=` / `<<` */
+    if (len == 1 && (src[1] == token[0] || src[1] == '=') && strchr("&|<>=", token[0]) != NULL) { return false; }
+    if (len == 1 && token[0] == '!' && src[1] == '=') { return false; }
+
+    src += len;
+    return true;
+}
+
+static void emit(uint8_t op, int32_t arg) {
+    if (target->codelen >= MAXCODE) { parseError("expression too long"); }
+
+    target->code[target->codelen].op = op;
+    target->code[target->codelen].arg = arg;
+    target->codelen++;
+}
+
+static int32_t parseNumber() {
+    skipSpace();
+
+    char* end = NULL;
+    long value = 0;
+
+    if (*src == '$') {
+        value = strtol(src + 1, &end, 16);
+        if (end == src + 1) { parseError("bad hex number"); }
+    } else if (*src == '%') {
+        value = strtol(src + 1, &end, 2);
+        if (end == src + 1) { parseError("bad binary number"); }
+    } else if (isdigit((unsigned char)*src)) {
+        value = strtol(src, &end, 0);
+    } else {
+        parseError("number expected");
+    }
+
+    src = end;
+    return (int32_t)value;
+}
+
+static void parseAddress(long base, long limit) {
+    if (!accept("[")) { parseError("`[` expected"); }
+
+    long addr = parseNumber();
+
+    if (addr < 0 || addr >= limit) { parseError("address out of range"); }
+    if (!accept("]")) { parseError("`]` expected"); }
+
+    emit(OP_MEM, (int32_t)(base + addr));
+}
+
+static void parseBinary(int level);
+
+static void parseUnary() {
+    skipSpace();
+
+    if (accept("!")) { parseUnary(); emit(OP_NOT, 0); return; }
+    if (accept("~")) { parseUnary(); emit(OP_INV, 0); return; }
+    if (accept("-")) { parseUnary(); emit(OP_NEG, 0); return; }
+
+    if (accept("(")) {
+        parseBinary(0);
+        if (!accept(")")) { parseError("`)` expected"); }
+        return;
+    }
+
+    if (strncmp(src, "mem", 3) == 0) {
+        src += 3;
+        parseAddress(0, MEMSIZE);
+        return;
+    }
+
+    if (strncmp(src, "sid", 3) == 0) {
+        src += 3;
+        parseAddress(SIDBASE, 0x20);
+        return;
+    }
+
+    emit(OP_CONST, parseNumber());
+}
+
+typedef struct {
+    const char* token;
+    uint8_t op;
+} watchoperator_t;
+
+/* Lowest precedence first, each level lists its operators */
+static const watchoperator_t operators[][5] = {
+    { { "||", OP_LOR } },
+    { { "&&", OP_LAND } },
+    { { "|", OP_OR } },
+    { { "^", OP_XOR } },
+    { { "&", OP_AND } },
+    { { "==", OP_EQ }, { "!=", OP_NE } },
+    { { "<=", OP_LE }, { ">=", OP_GE }, { "<", OP_LT }, { ">", OP_GT } },
+    { { "<<", OP_SHL }, { ">>", OP_SHR } },
+    { { "+", OP_ADD }, { "-", OP_SUB } },
+    { { "*", OP_MUL }, { "/", OP_DIV }, { "%", OP_MOD } },
+};
+
+#define LEVELS (int)(sizeof(operators)/sizeof(operators[0]))
+
+static void parseBinary(int level) {
+    if (level >= LEVELS) {
+        parseUnary();
+        return;
+    }
+
+    parseBinary(level + 1);
+
+    bool found = true;
+    while (found) {
+        found = false;
+
+        for (int i = 0; i < 5 && operators[level][i].token != NULL; i++) {
+            if (accept(operators[level][i].token)) {
+                parseBinary(level + 1);
+                emit(operators[level][i].op, 0);
+                found = true;
+                break;
+            }
+        }
+    }
+}
+
+static bool evaluate(const watch_t* w) {
+    int32_t stack[MAXSTACK];
+    int sp = 0;
+
+    for (int i = 0; i < w->codelen; i++) {
+        const watchop_t* o = &w->code[i];
+
+        if (o->op == OP_CONST) { stack[sp++] = o->arg; continue; }
+        if (o->op == OP_MEM) { stack[sp++] = memory[o->arg]; continue; }
+
+        int32_t r = stack[--sp];
+
+        switch (o->op) {
+            case OP_NOT: stack[sp++] = !r; continue;
+            case OP_INV: stack[sp++] = ~r; continue;
+            case OP_NEG: stack[sp++] = -r; continue;
+        }
+
+        int32_t l = stack[--sp];
+
+        switch (o->op) {
+            case OP_MUL: l = l * r; break;
+            case OP_DIV: l = r ? l / r : 0; break;
+            case OP_MOD: l = r ? l % r : 0; break;
+            case OP_ADD: l = l + r; break;
+            case OP_SUB: l = l - r; break;
+            case OP_SHL: l = l << (r & 31); break;
+            case OP_SHR: l = l >> (r & 31); break;
+            case OP_LT: l = l < r; break;
+            case OP_LE: l = l <= r; break;
+            case OP_GT: l = l > r; break;
+            case OP_GE: l = l >= r; break;
+            case OP_EQ: l = l == r; break;
+            case OP_NE: l = l != r; break;
+            case OP_AND: l = l & r; break;
+            case OP_XOR: l = l ^ r; break;
+            case OP_OR: l = l | r; break;
+            case OP_LAND: l = l && r; break;
+            case OP_LOR: l = l || r; break;
+        }
+
+        stack[sp++] = l;
+    }
+
+    return stack[0] != 0;
+}
+
+/* Worst case stack depth of the compiled code, so evaluate() can't overflow */
+static int stackDepth(const watch_t* w) {
+    int depth = 0;
+    int maxdepth = 0;
+
+    for (int i = 0; i < w->codelen; i++) {
+        uint8_t op = w->code[i].op;
+
+        if (op == OP_CONST || op == OP_MEM) { depth++; }
+        else if (op > OP_NEG) { depth--; }
+
+        if (depth > maxdepth) { maxdepth = depth; }
+    }
+
+    return maxdepth;
+}
+
+void watchAdd(const char* expression) {
+    if (watch_count >= MAXWATCHES) {
+        printf("Too many watch expressions (max %d). Exiting...\n", MAXWATCHES);
+        exit(1);
+    }
+
+    watch_t* w = &watches[watch_count];
+    memset(w, 0, sizeof(*w));
+    w->text = expression;
+
+    target = w;
+    src = expression;
+
+    parseBinary(0);
+    skipSpace();
+
+    if (*src != '\0') { parseError("unexpected input"); }
+    if (stackDepth(w) > MAXSTACK) { parseError("expression too deep"); }
+
+    for (int i = 0; i < w->codelen; i++) {
+        if (w->code[i].op == OP_MEM) {
+            watch_map[w->code[i].arg] |= (uint16_t)(1 << watch_count);
+        }
+    }
+
+    verbose("Watch #%d: `%s`\n", watch_count + 1, expression);
+    watch_count++;
+}
+
+int watchCount() {
+    return watch_count;
+}
+
+void watchBegin(int maxHits) {
+    watch_maxhits = maxHits < 1 ? 1 : (maxHits > MAXWATCHHITS ? MAXWATCHHITS : maxHits);
+    watch_frame = 0;
+
+    for (int i = 0; i < watch_count; i++) {
+        watches[i].state = evaluate(&watches[i]);
+        watches[i].hitcount = 0;
+    }
+}
+
+/* Called from write6502() for addresses with a non-zero watch_map entry */
+void watchWrite(uint16_t addr) {
+    uint16_t mask = watch_map[addr];
+
+    for (int i = 0; mask != 0; i++, mask >>= 1) {
+        if ((mask & 1) == 0) { continue; }
+
+        watch_t* w = &watches[i];
+        bool state = evaluate(w);
+
+        /* A hit is a false -> true transition; frames are numbered so that
+           `--framecount <hit>` reproduces the state right after it */
+        if (state && !w->state && w->hitcount < watch_maxhits) {
+            int hit = watch_frame + 1;
+
+            if (w->hitcount == 0 || w->hits[w->hitcount - 1] != hit) {
+                w->hits[w->hitcount++] = hit;
+            }
+        }
+
+        w->state = state;
+    }
+}
+
+/* Returns true once every watch has collected all the hits asked for */
+bool watchFrameDone(int frame) {
+    watch_frame = frame;
+
+    for (int i = 0; i < watch_count; i++) {
+        if (watches[i].hitcount < watch_maxhits) { return false; }
+    }
+
+    return watch_count > 0;
+}
+
+void watchReport() {
+    for (int i = 0; i < watch_count; i++) {
+        const watch_t* w = &watches[i];
+
+        if (w->hitcount == 0) {
+            printf("Watch #%d `%s`: no match\n", i + 1, w->text);
+            continue;
+        }
+
+        printf("Watch #%d `%s`: frame", i + 1, w->text);
+
+        for (int h = 0; h < w->hitcount; h++) {
+            printf("%s %d", h ? "," : "", w->hits[h]);
+        }
+
+        putchar('\n');
+    }
+}
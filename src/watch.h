@@ -0,0 +1,28 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "sidulator.h"
+
+#define MAXWATCHES 16
+#define MAXWATCHHITS 64
+
+/*
+ * Watch expressions are small C-like predicates over emulated memory, e.g.
+ *
+ *     mem[$0a3f]==$0c && sid[$0b]&1
+ *
+ * They are compiled once and re-evaluated only when one of the addresses
+ * they read is written. watch_map[addr] holds a bit for every watch that
+ * reads addr, so write6502() only has to test a single table entry.
+ */
+extern uint16_t watch_map[MEMSIZE];
+
+void watchAdd(const char* expression);
+int watchCount();
+
+void watchBegin(int maxHits);
+void watchWrite(uint16_t addr);
+bool watchFrameDone(int frame);
+void watchReport();
+
+#endif
@@ -0,0 +1,55 @@
+/* Checks the latency buckets of loadgen.c: every microsecond value lands in
+   one bucket, buckets are contiguous, and each is within 1/64 of its values */
+
+#include "../src/loadgen.c"
+
+/* loadgen.c is taken in whole for its static helpers, the scheduler isn't needed */
+void scheduleBegin(const schedule_t* schedule) { (void)schedule; }
+bool scheduleSubmit(const char* id, int frame, int priority, double deadline, double submitted) {
+    (void)id; (void)frame; (void)priority; (void)deadline; (void)submitted;
+    return false;
+}
+bool scheduleStep() { return false; }
+int scheduleEnd() { return 0; }
+double scheduleNow() { return 0; }
+int verbose(const char * restrict format, ...) { (void)format; return 0; }
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, uint64_t value) {
+    if (ok) { return; }
+
+    printf("%s: %llu\n", what, (unsigned long long)value);
+    failures++;
+}
+
+int main() {
+    uint64_t previousTop = 0;
+
+    for (int b = 0; b < HISTBUCKETS; b++) {
+        uint64_t top = bucketTop(b);
+        uint64_t bottom = b == 0 ? 0 : previousTop + 1;
+
+        check(b == 0 || top > previousTop, "bucket top not increasing", (uint64_t)b);
+        check(bucketOf(bottom) == b, "bucket bottom lands elsewhere", bottom);
+        check(bucketOf(top) == b, "bucket top lands elsewhere", top);
+        check(bottom < 2 * SUBBUCKETS || (top - bottom + 1) * SUBBUCKETS <= bottom, "bucket wider than 1/64", bottom);
+
+        previousTop = top;
+    }
+
+    check(previousTop == UINT64_MAX, "buckets end early", previousTop);
+
+    for (uint64_t us = 0; us < 1000000; us++) {
+        int b = bucketOf(us);
+        check(b >= 0 && b < HISTBUCKETS && us <= bucketTop(b) && (b == 0 || us > bucketTop(b - 1)), "value outside its bucket", us);
+    }
+
+    if (failures > 0) {
+        printf("%d bucket checks failed\n", failures);
+        return 1;
+    }
+
+    printf("Buckets ok, %d of them\n", HISTBUCKETS);
+    return 0;
+}